@@ -0,0 +1,514 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* libregutils benchmarks
+ *
+ * Usage: bench [-s size] [-t seconds] [filter]
+ *
+ * Every benchmark runs on a deterministic corpus (see corpus.c) for at least
+ * the given amount of time. Only benchmarks whose name contains "filter" are
+ * run. The throughput, the time per operation and the heap allocations per
+ * operation are reported. A benchmark that shall not allocate and does makes
+ * the suite fail. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <regutils.h>
+#include "corpus.h"
+
+typedef enum {
+	OP_MATCH = 0,
+	OP_REPLACE,
+	OP_SPLIT,
+	OP_ESCAPE,
+	OP_COLUMNS,
+	OP_STEP,
+	OP_PARALLEL,
+	OP_COLD,
+	OP_PRELOAD,
+	OP_OFFSETS,
+	OP_COMPACT,
+	OP_SUBMASK,
+	OP_TIMEOUT,
+	OP_PROFILE,
+	OP_POOL,
+	OP_REUSE,
+	OP_REUSE_REPLACE,
+	OP_REUSE_SPLIT,
+	OP_RULES,
+	OP_RULES_SEQ
+} Bench_op;
+
+typedef struct {
+	const char* name;
+	Bench_op op;
+	Corpus_kind corpus;
+	const char* pattern;
+	const char* rep;
+	int cflags;
+	size_t size;           // Corpus size. Zero stands for the default size
+	int no_allocs;         // 1 if an operation shall not allocate at all
+} Bench;
+
+static const Bench benches[] = {
+	{ "match/log_ip",        OP_MATCH,   CORPUS_LOG,
+	  "([0-9]+\\.){3}[0-9]+", NULL, 0, 0 },
+	{ "match/log_level",     OP_MATCH,   CORPUS_LOG,
+	  "ERROR|WARN", NULL, 0, 0 },
+	{ "match/csv_amount",    OP_MATCH,   CORPUS_CSV,
+	  "[0-9]+\\.[0-9]+", NULL, 0, 0 },
+	{ "match/prose_icase",   OP_MATCH,   CORPUS_PROSE,
+	  "the", NULL, REG_ICASE, 0 },
+	{ "match/prose_lines",   OP_MATCH,   CORPUS_PROSE,
+	  "^[a-z]+", NULL, REG_NEWLINE, 0 },
+	{ "match/log_anchored",  OP_MATCH,   CORPUS_LOG,
+	  "^[0-9]+-", NULL, 0, 0 },
+	{ "match/tiny_matches",  OP_MATCH,   CORPUS_REPEAT,
+	  "a", NULL, 0, 64 * 1024 },
+	{ "match/backtrack",     OP_MATCH,   CORPUS_REPEAT,
+	  "(a|aa)*b", NULL, 0, 2 * 1024 },
+	{ "match/bre_bref",      OP_MATCH,   CORPUS_REPEAT,
+	  "\\(a*\\)\\1b", NULL, -REG_EXTENDED, 128 },
+	{ "offsets/prose_words", OP_OFFSETS, CORPUS_PROSE,
+	  "[a-z]+", NULL, 0, 0 },
+	{ "compact/prose_words", OP_COMPACT, CORPUS_PROSE,
+	  "[a-z]+", NULL, 0, 0 },
+	{ "match/log_paths",     OP_MATCH,   CORPUS_LOG,
+	  "(GET|POST|PUT|DELETE) (/[a-z0-9]+)+", NULL, 0, 0 },
+	{ "submask/log_paths",   OP_SUBMASK, CORPUS_LOG,
+	  "(GET|POST|PUT|DELETE) (/[a-z0-9]+)+", NULL, 0, 0 },
+	{ "profile/log_paths",   OP_PROFILE, CORPUS_LOG,
+	  "(GET|POST|PUT|DELETE) (/[a-z0-9]+)+", NULL, 0, 0 },
+	{ "match/bre_bref2",     OP_MATCH,   CORPUS_RUNS,
+	  "\\(a*\\)*\\(a*\\)*\\2\\1b", NULL, -REG_EXTENDED, 1024 },
+	{ "timeout/bre_bref2",   OP_TIMEOUT, CORPUS_RUNS,
+	  "\\(a*\\)*\\(a*\\)*\\2\\1b", NULL, -REG_EXTENDED, 0 },
+	{ "replace/prose_literal", OP_REPLACE, CORPUS_PROSE,
+	  "the", "THE", 0, 0 },
+	{ "replace/log_bref",    OP_REPLACE, CORPUS_LOG,
+	  "([0-9]+)\\.([0-9]+)\\.([0-9]+)\\.([0-9]+)", "$4.$3.$2.$1", 0, 0 },
+	{ "replace/csv_bref",    OP_REPLACE, CORPUS_CSV,
+	  "^([^,]*),([^,]*)", "$2,$1", REG_NEWLINE, 0 },
+	{ "split/csv_comma",     OP_SPLIT,   CORPUS_CSV,
+	  ",", NULL, 0, 0 },
+	{ "split/prose_blank",   OP_SPLIT,   CORPUS_PROSE,
+	  "[ \t\n]+", NULL, 0, 0 },
+	{ "split/log_lines",     OP_SPLIT,   CORPUS_LOG,
+	  "\n", NULL, 0, 0 },
+	{ "split/log_fields",    OP_SPLIT,   CORPUS_LOG,
+	  " +|=", NULL, 0, 0 },
+	{ "split/csv_columns",   OP_COLUMNS, CORPUS_CSV,
+	  ",", NULL, 0, 0 },
+	{ "parallel/prose_literal", OP_PARALLEL, CORPUS_PROSE,
+	  "the", "THE", 0, 0 },
+	{ "parallel/log_bref",   OP_PARALLEL, CORPUS_LOG,
+	  "([0-9]+)\\.([0-9]+)\\.([0-9]+)\\.([0-9]+)", "$4.$3.$2.$1", 0, 0 },
+	{ "parallel/csv_bref",   OP_PARALLEL, CORPUS_CSV,
+	  "^([^,]*),([^,]*)", "$2,$1", REG_NEWLINE, 0 },
+	{ "step/log_level",      OP_STEP,    CORPUS_LOG,
+	  "ERROR|WARN", NULL, 0, 0 },
+	{ "step/csv_comma",      OP_STEP,    CORPUS_CSV,
+	  ",", NULL, 0, 0 },
+	{ "escape/prose_ere",    OP_ESCAPE,  CORPUS_PROSE,
+	  NULL, NULL, PREG_ERE, 0 },
+	{ "escape/prose_bre",    OP_ESCAPE,  CORPUS_PROSE,
+	  NULL, NULL, PREG_BRE, 0 },
+	{ "cold/lazy_patterns",  OP_COLD,    CORPUS_LINE,
+	  NULL, NULL, 0, 256 },
+	{ "cold/preload_patterns", OP_PRELOAD, CORPUS_LINE,
+	  NULL, NULL, 0, 256 },
+	{ "fresh/line_match",    OP_MATCH,   CORPUS_LINE,
+	  "ms=([0-9]+)", NULL, 0, 256 },
+	{ "pool/line_match",     OP_POOL,    CORPUS_LINE,
+	  "ms=([0-9]+)", NULL, 0, 256 },
+	{ "reuse/line_match",    OP_REUSE,   CORPUS_LINE,
+	  "ms=([0-9]+)", NULL, 0, 256 },
+	{ "reuse/line_count",    OP_REUSE,   CORPUS_LINE,
+	  "ms=[0-9]+", NULL, 0, 256, 1 },
+	{ "reuse/line_replace",  OP_REUSE_REPLACE, CORPUS_LINE,
+	  "ms=[0-9]+", "ms=0", 0, 256, 1 },
+	{ "reuse/line_split",    OP_REUSE_SPLIT,   CORPUS_LINE,
+	  " ", NULL, 0, 256, 1 },
+	{ "rules/prose_single",  OP_RULES,     CORPUS_PROSE,
+	  NULL, NULL, 0, 0 },
+	{ "rules/prose_seq",     OP_RULES_SEQ, CORPUS_PROSE,
+	  NULL, NULL, 0, 0 }
+};
+
+/* The rules of the OP_RULES benchmarks, applied either with
+ * preg_replace_rules() or with one preg_replace() per rule */
+static const char* const rules[][2] = {
+	{ "&", "&amp;" },
+	{ "<", "&lt;" },
+	{ ">", "&gt;" },
+	{ "\"", "&quot;" },
+	{ "'", "&#39;" },
+	{ "\\.\\.\\.", "..." },
+	{ "([a-z]+)@([a-z]+)", "$1 at $2" },
+	{ "[0-9]{3,}", "###" },
+	{ "\\bthe\\b", "THE" },
+	{ "quick", "slow" },
+	{ "[ \t]+\n", "\n" },
+	{ "  +", " " }
+};
+
+static size_t allocs;
+
+// The pool of the OP_POOL benchmarks
+static Preg_pool* pool;
+
+#ifdef __GLIBC__
+/* Count the heap allocations by interposing the allocator */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+#define ALLOCS_COUNTED 1
+#else
+#define ALLOCS_COUNTED 0
+#endif
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static Preg* bench_handle(const Bench* b)
+{
+	Preg* rm;
+	int i;
+
+	rm = preg_init();
+	if (!rm) {
+		fprintf(stderr, "Memory allocation failure\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (b->cflags > 0)
+		preg_setopt(rm, PREG_CFLAGS, b->cflags);
+	else if (b->cflags < 0)
+		preg_delopt(rm, PREG_CFLAGS, -b->cflags);
+
+	// Every step searches about 64KB of the subject
+	if (b->op == OP_STEP)
+		preg_setopt(rm, PREG_STEPBYTES, 64 * 1024);
+	else if (b->op == OP_PARALLEL || b->op == OP_PRELOAD)
+		preg_setopt(rm, PREG_THREADS, 4);
+	else if (b->op == OP_OFFSETS)
+		preg_setopt(rm, PREG_UFLAGS, PREG_NOSTRINGS);
+	else if (b->op == OP_COMPACT)
+		preg_setopt(rm, PREG_UFLAGS, PREG_NOSTRINGS | PREG_COMPACT);
+	else if (b->op == OP_SUBMASK)
+		preg_setopt(rm, PREG_SUBMASK, 1);   // The match alone
+	else if (b->op == OP_TIMEOUT)
+		preg_setopt(rm, PREG_TIMEOUT, 10);  // Milliseconds
+	else if (b->op == OP_PROFILE)
+		preg_setopt(rm, PREG_UFLAGS, PREG_PROFILE);
+
+	if (b->op == OP_RULES)
+		for (i = 0; i < sizeof(rules) / sizeof(rules[0]); ++i)
+			if (preg_addrule(rm, rules[i][0], rules[i][1])) {
+				fprintf(stderr, "%s: %s\n", b->name, preg_errmsg(rm));
+				exit(EXIT_FAILURE);
+			}
+
+	return rm;
+}
+
+static void bench_check(const Bench* b, Preg* rm, int err)
+{
+	if (b->op == OP_TIMEOUT && err == PREG_TIMEDOUT)
+		return;
+
+	if (err && err != REG_NOMATCH) {
+		fprintf(stderr, "%s: %s\n", b->name, preg_errmsg(rm));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Applies the rules with one preg_replace() per rule, copying the result of
+ * every substitution to the subject of the next one */
+static int bench_rules_seq(Preg* rm, const char* subject)
+{
+	char* cur = NULL;
+	size_t len;
+	int err = 0;
+	int i;
+
+	for (i = 0; i < sizeof(rules) / sizeof(rules[0]); ++i) {
+		err = preg_replace(rm, cur ? cur : subject, rules[i][0], rules[i][1]);
+		if (err == REG_NOMATCH)
+			continue;
+		else if (err)
+			break;
+
+		len = preg_replen(rm);
+		free(cur);
+		cur = malloc(len +1);
+		if (!cur) {
+			fprintf(stderr, "Memory allocation failure\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(cur, preg_getrep(rm), len +1);
+	}
+	free(cur);
+
+	return err == REG_NOMATCH ? 0 : err;
+}
+
+#define COLD_PATTERNS 512
+
+/* Matches COLD_PATTERNS patterns, like a configuration would, with a new
+ * handle, after compiling all of them up front if "preload" is set */
+static int bench_cold(Preg* rm, const char* subject, int preload)
+{
+	static char patterns[COLD_PATTERNS][48];
+	static Preg_pattern pats[COLD_PATTERNS];
+	int err = 0;
+	int i;
+
+	if (!pats[0].pattern)
+		for (i = 0; i < COLD_PATTERNS; ++i) {
+			snprintf(patterns[i], sizeof(patterns[i]),
+			         "(key%d|id%d)=([0-9a-f]+|\\[[^]]*])", i, i);
+			pats[i].pattern = patterns[i];
+			pats[i].cflags  = REG_EXTENDED;
+		}
+
+	if (preload && (err = preg_preload(rm, pats, COLD_PATTERNS)))
+		return err;
+
+	for (i = 0; i < COLD_PATTERNS; ++i) {
+		err = preg_match(rm, subject, pats[i].pattern);
+		if (err && err != REG_NOMATCH)
+			break;
+	}
+
+	return err == REG_NOMATCH ? 0 : err;
+}
+
+/* Matches "pattern" and reads the offsets of every match and subexpression
+ * back, as a tokenizer would */
+static int bench_offsets(Preg* rm, const char* subject, const char* pattern)
+{
+	volatile size_t sum = 0;
+	size_t i, j;
+	int err;
+
+	if ((err = preg_match(rm, subject, pattern)))
+		return err;
+
+	for (i = 0; i < preg_matc(rm); ++i)
+		for (j = 0; j <= preg_subc(rm); ++j)
+			sum += preg_end(rm, i, j) -preg_start(rm, i, j);
+
+	return 0;
+}
+
+/* Performs one operation of the benchmark "b" on "subject" */
+static void bench_op(const Bench* b, const char* subject, size_t len,
+                     Preg* reused)
+{
+	Preg* rm = reused;
+	char* esc;
+	int err = 0;
+
+	if (b->op == OP_ESCAPE) {
+		esc = preg_escape(subject, b->cflags, len);
+		if (!esc) {
+			fprintf(stderr, "%s: Memory allocation failure\n", b->name);
+			exit(EXIT_FAILURE);
+		}
+		free(esc);
+		return;
+	}
+
+	// Every operation takes a handle from the pool and returns it
+	if (b->op == OP_POOL && !(rm = preg_pool_get(pool))) {
+		fprintf(stderr, "Memory allocation failure\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!rm)
+		rm = bench_handle(b);
+
+	switch (b->op) {
+	case OP_MATCH:
+	case OP_SUBMASK:
+	case OP_TIMEOUT:
+	case OP_PROFILE:
+	case OP_POOL:
+	case OP_REUSE:
+		err = preg_match(rm, subject, b->pattern);
+		break;
+	case OP_REPLACE:
+	case OP_PARALLEL:
+	case OP_REUSE_REPLACE:
+		err = preg_replace(rm, subject, b->pattern, b->rep);
+		break;
+	case OP_SPLIT:
+	case OP_REUSE_SPLIT:
+		err = preg_split(rm, subject, b->pattern);
+		break;
+	case OP_COLUMNS:
+		err = preg_split_columns(rm, subject, b->pattern);
+		break;
+	case OP_STEP:
+		while ((err = preg_match(rm, subject, b->pattern)) == PREG_INPROGRESS)
+			;
+		break;
+	case OP_RULES:
+		err = preg_replace_rules(rm, subject);
+		break;
+	case OP_RULES_SEQ:
+		err = bench_rules_seq(rm, subject);
+		break;
+	case OP_COLD:
+	case OP_PRELOAD:
+		err = bench_cold(rm, subject, b->op == OP_PRELOAD);
+		break;
+	case OP_OFFSETS:
+	case OP_COMPACT:
+		err = bench_offsets(rm, subject, b->pattern);
+		break;
+	default:
+		break;
+	}
+	bench_check(b, rm, err);
+
+	if (b->op == OP_POOL)
+		preg_pool_put(pool, rm);
+	else if (!reused)
+		preg_free(rm);
+}
+
+static void bench_run(const Bench* b, size_t size, double min_time)
+{
+	Preg* reused = NULL;
+	char* subject;
+	size_t len;
+	size_t ops = 0;
+	size_t allocs_start;
+	size_t allocated;
+	double start;
+	double elapsed;
+
+	subject = corpus_gen(b->corpus, b->size ? b->size : size, 0x9e3779b9);
+	if (!subject) {
+		fprintf(stderr, "Memory allocation failure\n");
+		exit(EXIT_FAILURE);
+	}
+	len = strlen(subject);
+
+	if (b->op >= OP_REUSE)
+		reused = bench_handle(b);
+	else if (b->op == OP_POOL && !(pool = preg_pool_init(1, NULL))) {
+		fprintf(stderr, "Memory allocation failure\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Warm up. The results of the first operation may overflow the arena of
+	 * the handle, which the second one merges into a single block */
+	bench_op(b, subject, len, reused);
+	bench_op(b, subject, len, reused);
+
+	allocs_start = allocs;
+	start = now();
+	do {
+		bench_op(b, subject, len, reused);
+		ops++;
+	} while ((elapsed = now() -start) < min_time);
+
+	allocated = allocs -allocs_start;
+
+	printf("%-24s %10zu %10.2f MB/s %14.0f ns/op", b->name, len,
+	       len * ops / elapsed / 1e6, elapsed * 1e9 / ops);
+	if (ALLOCS_COUNTED)
+		printf(" %10.1f allocs/op", (double)allocated / ops);
+	printf("\n");
+
+	// A warmed-up handle shall not allocate on these
+	if (ALLOCS_COUNTED && b->no_allocs && allocated) {
+		fprintf(stderr, "%s: %zu allocations after warm-up\n", b->name,
+		        allocated);
+		exit(EXIT_FAILURE);
+	}
+
+	preg_free(reused);
+	preg_pool_free(pool);
+	pool = NULL;
+	free(subject);
+}
+
+int main(int argc, char** argv)
+{
+	const char* filter = NULL;
+	size_t size = 1024 * 1024;
+	double min_time = 0.5;
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-s") && i +1 < argc)
+			size = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-t") && i +1 < argc)
+			min_time = strtod(argv[++i], NULL);
+		else if (argv[i][0] != '-')
+			filter = argv[i];
+		else {
+			fprintf(stderr, "Usage: %s [-s size] [-t seconds] [filter]\n",
+			        argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%-24s %10s %15s %17s%s\n", "benchmark", "bytes", "throughput",
+	       "time", ALLOCS_COUNTED ? "        allocations" : "");
+
+	for (i = 0; i < sizeof(benches)/sizeof(*benches); ++i)
+		if (!filter || strstr(benches[i].name, filter))
+			bench_run(&benches[i], size, min_time);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "corpus.h"
+
+static const char* words[] = {
+	"the", "of", "and", "a", "to", "in", "is", "you", "that", "it", "he",
+	"was", "for", "on", "are", "as", "with", "his", "they", "I", "at", "be",
+	"this", "have", "from", "or", "one", "had", "by", "word", "but", "not",
+	"what", "all", "were", "we", "when", "your", "can", "said", "there",
+	"use", "an", "each", "which", "she", "do", "how", "their", "if", "will",
+	"up", "other", "about", "out", "many", "then", "them", "these", "so",
+	"some", "her", "would", "make", "like", "him", "into", "time", "has",
+	"look", "two", "more", "write", "go", "see", "number", "no", "way",
+	"could", "people", "my", "than", "first", "water", "been", "call",
+	"who", "oil", "its", "now", "find", "long", "down", "day", "did", "get",
+	"come", "made", "may", "part", "(sic)", "e.g.", "$5", "[1]", "50%"
+};
+
+static const char* levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN",
+                                "ERROR" };
+static const char* methods[] = { "GET", "GET", "POST", "PUT", "DELETE" };
+static const char* names[] = { "john", "maria", "nikos", "eleni", "li",
+                               "fatima", "olga", "pedro" };
+static const char* cities[] = { "Athens", "Berlin", "Lagos", "Lima", "Osaka",
+                                "Oslo", "New York" };
+
+#define NELEM(x) (sizeof(x)/sizeof(*(x)))
+
+/* A small xorshift generator, so that the corpora do not depend on the
+ * libc's rand() */
+static unsigned next(unsigned* state)
+{
+	unsigned x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+static int gen_log(char* buf, size_t avail, unsigned* st)
+{
+	return snprintf(buf, avail,
+	    "2022-%02u-%02uT%02u:%02u:%02u.%03uZ %s [worker-%u] %s "
+	    "/api/v1/items/%u %u %u ms=%u ip=%u.%u.%u.%u\n",
+	    next(st) % 12 +1, next(st) % 28 +1, next(st) % 24, next(st) % 60,
+	    next(st) % 60, next(st) % 1000, levels[next(st) % NELEM(levels)],
+	    next(st) % 32, methods[next(st) % NELEM(methods)], next(st) % 100000,
+	    next(st) % 4 ? 200 : 404, next(st) % 8192, next(st) % 500,
+	    next(st) % 256, next(st) % 256, next(st) % 256, next(st) % 256);
+}
+
+static int gen_csv(char* buf, size_t avail, unsigned* st)
+{
+	return snprintf(buf, avail, "%u,%s,%s,%u.%02u,2022-%02u-%02u,%s,\n",
+	    next(st) % 1000000, names[next(st) % NELEM(names)],
+	    names[next(st) % NELEM(names)], next(st) % 1000, next(st) % 100,
+	    next(st) % 12 +1, next(st) % 28 +1, cities[next(st) % NELEM(cities)]);
+}
+
+static int gen_prose(char* buf, size_t avail, unsigned* st)
+{
+	int len;
+	int n = 0;
+	int i;
+
+	for (i = next(st) % 12 +4; i > 0; --i) {
+		len = snprintf(&buf[n], avail -n, i > 1 ? "%s " : "%s",
+		               words[next(st) % NELEM(words)]);
+		if (len >= avail -n)
+			return avail;
+		n += len;
+	}
+	n += snprintf(&buf[n], avail -n, next(st) % 6 ? ". " : ".\n\n");
+
+	return n;
+}
+
+/* Backreference patterns take time that grows fast with the length of the
+ * run, so runs are kept short */
+static int gen_runs(char* buf, size_t avail, unsigned* st)
+{
+	return snprintf(buf, avail, "%.*sb\n", (int)(next(st) % 8 +8),
+	                "aaaaaaaaaaaaaaaa");
+}
+
+char* corpus_gen(Corpus_kind kind, size_t size, unsigned seed)
+{
+	unsigned st = seed ? seed : 1;
+	size_t n = 0;
+	char* buf;
+	int len;
+
+	buf = malloc(size +1);
+	if (!buf)
+		return NULL;
+
+	if (kind == CORPUS_REPEAT) {
+		memset(buf, 'a', size);
+		buf[size] = '\0';
+		return buf;
+	}
+
+	while (n < size) {
+		switch (kind) {
+		case CORPUS_LOG:
+		case CORPUS_LINE:
+			len = gen_log(&buf[n], size -n +1, &st);
+			break;
+		case CORPUS_CSV:
+			len = gen_csv(&buf[n], size -n +1, &st);
+			break;
+		case CORPUS_RUNS:
+			len = gen_runs(&buf[n], size -n +1, &st);
+			break;
+		default:
+			len = gen_prose(&buf[n], size -n +1, &st);
+		}
+
+		// Truncated records are dropped
+		if (len > size -n)
+			break;
+		n += len;
+
+		if (kind == CORPUS_LINE)
+			break;
+	}
+	buf[n] = '\0';
+
+	return buf;
+}
@@ -0,0 +1,40 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+
+typedef enum Corpus_kind {
+	CORPUS_LOG = 0,   // Web server style log lines
+	CORPUS_CSV,       // Comma separated records
+	CORPUS_PROSE,     // English-like text
+	CORPUS_REPEAT,    // A single repeated character
+	CORPUS_LINE,      // One log line
+	CORPUS_RUNS       // Lines of a run of 'a' followed by a 'b'
+} Corpus_kind;
+
+/* Generates a null-terminated corpus of about "size" bytes. The same "kind",
+ * "size" and "seed" always produce the same corpus */
+char* corpus_gen(Corpus_kind kind, size_t size, unsigned seed);
+
+#endif
@@ -0,0 +1,90 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <regutils.hpp>
+
+int main()
+{
+	const std::string subject = "There's a _ inside the crate";
+
+	std::cout << "This is a demo of the C++ interface of libregutils. Our "
+	             "subject string is: " << subject << "\n";
+
+	/* A Handle owns a Preg handle and frees it when it goes out of scope. It
+	 * can be moved but not copied */
+	regutils::Handle rm;
+
+	rm.setopt(PREG_CFLAGS, REG_ICASE);
+
+	/* The operations return the error codes of the C functions. The results
+	 * are std::string_views into the subject, so the subject shall outlive
+	 * them */
+	int err = rm.match(subject, "c([[:alpha:]]+)e");
+	if (err == REG_NOMATCH)
+		std::cout << "No matches? No problem!\n";
+	else if (err) {
+		std::cout << "An unexpected error occured: " << rm.errmsg() << "\n";
+		return 1;
+	}
+	else {
+		for (regutils::Match m : rm.matches())
+			for (std::size_t j = 0; j < m.size(); ++j)
+				std::cout << "The term \"" << m[j] << "\" was found with a "
+				             "starting offset of " << m.so(j) << " and an "
+				             "ending offset of " << m.eo(j) << "\n";
+	}
+
+	if (rm.replace(subject, "_ inside the c([[:alpha:]]+)e",
+	               "$1 inside the crate")) {
+		std::cout << "An error occured: " << rm.errmsg() << "\n";
+		return 1;
+	}
+	std::cout << "The replaced string is: " << rm.rep() << "\n";
+
+	/* Splits are taken from the subject as well. A std::string_view subject
+	 * need not be null-terminated */
+	std::string_view words = std::string_view(subject).substr(0, 13);
+
+	if (rm.split(words, "[_ ]")) {
+		std::cout << "An error occured: " << rm.errmsg() << "\n";
+		return 1;
+	}
+	std::cout << "The split strings of \"" << words << "\" are:\n";
+	for (std::string_view s : rm.splits())
+		std::cout << s << "\n";
+
+	/* Patterns known at build time can be escaped and classified at compile
+	 * time. Literals are then searched without compiling them */
+	constexpr auto dot = regutils::escape("Mr. Smith");
+	static_assert(dot.view() == "Mr\\. Smith");
+
+	constexpr auto inside = regutils::pattern("inside");
+	static_assert(inside.kind == regutils::Pattern_kind::literal);
+
+	if (!rm.match(subject, inside))
+		std::cout << "\"" << rm.matches()[0].str() << "\" is at offset "
+		          << rm.matches()[0].so() << "\n";
+
+	return 0;
+}
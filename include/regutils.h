@@ -22,8 +22,13 @@
 #ifndef REGUTILS_H
 #define REGUTILS_H
 
+#include <sys/types.h>
 #include <regex.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Error codes shall start from -100 in order to not collide with backend
 // ones (as defined in regex.h)
 #define PREG_ERRCODE_START -100
@@ -34,6 +39,11 @@ typedef enum Preg_errcode {
 	PREG_BADMIN,                        // Min should be zero or positive
 	PREG_BADLIMIT,                      // Limit should be greater than -2
 	PREG_BADBREF,                       // Invalid backreference number
+	PREG_MEMLIMIT,                      // Memory limit exceeded
+	PREG_CBABORT,                       // Aborted by a callback
+	PREG_INPROGRESS,                    // Search in progress
+	PREG_TOOLARGE,                      // Subject too large for the pattern
+	PREG_TIMEDOUT,                      // Time limit exceeded
 	PREG_ERRCODE_END                    // Shall always be last
 } Preg_errcode;
 
@@ -41,11 +51,21 @@ typedef enum Preg_opt {
 	PREG_CFLAGS = 0,
 	PREG_UFLAGS,
 	PREG_MIN,
-	PREG_LIMIT
+	PREG_LIMIT,
+	PREG_MAXMEM,
+	PREG_STEPBYTES,
+	PREG_STEPEXECS,
+	PREG_THREADS,
+	PREG_SUBMASK,
+	PREG_TIMEOUT
 } Preg_opt;
 
 typedef enum Preg_uflags {
 	PREG_NOSTRINGS = 1,
+	PREG_STATS     = 2,
+	PREG_LITERAL   = 4,
+	PREG_COMPACT   = 8,
+	PREG_PROFILE   = 16
 } Preg_uflags;
 
 typedef enum Preg_notation {
@@ -53,13 +73,90 @@ typedef enum Preg_notation {
 	PREG_BRE
 } Preg_notation;
 
+typedef enum Preg_format {
+	PREG_TEXT = 0,
+	PREG_JSON
+} Preg_format;
+
 typedef struct Preg Preg;
+typedef struct Preg_buf Preg_buf;
+typedef struct Preg_pool Preg_pool;
+
+/* Called by preg_replace_cb() for every match. "match" holds the offsets of
+ * the match and its "nmatch" -1 subexpressions in "subject". The replacement
+ * shall be written to "buf" with preg_bufcat(). A non-zero return value
+ * aborts the substitution */
+typedef int (*Preg_replace_cb)(Preg_buf* buf, const char* subject,
+                               const regmatch_t* match, size_t nmatch,
+                               void* ctx);
+
+/* Resume token of a search (see preg_cursor()). Its members shall be treated
+ * as private */
+typedef struct Preg_cursor {
+	size_t offset;          // Byte offset where the search resumes
+	int eflags;             // Whether the resume point is at a line start
+	size_t index;           // Number of matches preceding the resume point
+	int done;               // Becomes 1 when the end of the subject is reached
+	int adjacent;           // Whether the resume point ends a non-empty match
+} Preg_cursor;
+
+typedef struct Preg_allocator {
+	void* (*alloc)(void* ctx, size_t size);
+	void* (*realloc)(void* ctx, void* ptr, size_t size);
+	void  (*free)(void* ctx, void* ptr);
+	void* ctx;              // Passed as the first argument of the functions
+} Preg_allocator;
+
+typedef struct Preg_stats {
+	size_t compiles;        // Number of compiled patterns
+	unsigned long long compile_ns; // Time spent compiling patterns
+	size_t execs;           // Number of regexec() calls
+	unsigned long long exec_ns;    // Time spent searching
+	size_t bytes_scanned;   // Subject bytes searched
+	size_t matches;         // Number of matches found
+	size_t pool_allocated;  // Bytes allocated for memory pools
+	size_t pool_retained;   // Bytes currently held by memory pools
+	size_t pool_blocks;     // Number of memory pool blocks currently held
+	size_t peak_mem;        // Peak value of pool_retained
+} Preg_stats;
+
+/* A log-bucketed histogram of PREG_PROFILE. "bucket[0]" counts the zeros and
+ * "bucket[n]" the values from 2^(n-1) to 2^n -1, except for the last one,
+ * which counts every larger value too */
+#define PREG_HIST_BUCKETS 64
+
+typedef struct Preg_histogram {
+	size_t count;           // Number of values
+	unsigned long long sum; // Sum of the values
+	unsigned long long max; // Largest value
+	size_t bucket[PREG_HIST_BUCKETS];
+} Preg_histogram;
+
+// The histograms PREG_PROFILE keeps for a compiled pattern
+typedef struct Preg_profile {
+	const char* pattern;
+	int cflags;             // The flags the pattern is compiled with
+	Preg_histogram compile_ns; // Time spent by every regcomp() call
+	Preg_histogram exec_ns;    // Time spent by every regexec() call
+	Preg_histogram bytes;      // Subject bytes every regexec() call searched
+} Preg_profile;
+
+/* An entry of the pattern set of preg_preload(). "err" is set to the error
+ * code of the compilation of the pattern, or 0 */
+typedef struct Preg_pattern {
+	const char* pattern;
+	int cflags;             // The flags the pattern is compiled with
+	int err;
+} Preg_pattern;
 
 /* Common functions */
 
 Preg* preg_init(void);
+Preg* preg_init_ex(const Preg_allocator* alloc);
 void  preg_free(Preg* rm);
 
+void preg_set_default_allocator(const Preg_allocator* alloc);
+
 void preg_setopt(Preg* rm, Preg_opt opt, int value);
 void preg_delopt(Preg* rm, Preg_opt opt, int value);
 
@@ -70,31 +167,78 @@ size_t preg_matchlen(const Preg* rm, int nmatch, int nsub);
 
 regoff_t preg_so(const Preg* rm, int nmatch, int nsub);
 regoff_t preg_eo(const Preg* rm, int nmatch, int nsub);
+ssize_t preg_start(const Preg* rm, size_t nmatch, size_t nsub);
+ssize_t preg_end(const Preg* rm, size_t nmatch, size_t nsub);
+
+void preg_cursor(const Preg* rm, Preg_cursor* cur);
+void preg_setcursor(Preg* rm, const Preg_cursor* cur);
 
 const char* preg_errmsg(const Preg* rm);
 int preg_errcode(const Preg* rm);
 
+void preg_stats(const Preg* rm, Preg_stats* stats);
+void preg_stats_reset(Preg* rm);
+
+int preg_preload(Preg* rm, Preg_pattern* pats, size_t n);
+
+size_t preg_profilec(const Preg* rm);
+const Preg_profile* preg_profile(const Preg* rm, size_t n);
+void preg_profile_reset(Preg* rm);
+char* preg_profile_dump(const Preg* rm, Preg_format format);
+
+Preg_pool* preg_pool_init(size_t max, const Preg_allocator* alloc);
+Preg* preg_pool_get(Preg_pool* pool);
+void  preg_pool_put(Preg_pool* pool, Preg* rm);
+void  preg_pool_free(Preg_pool* pool);
+
 /* Match functions */
 
 int preg_match(Preg* rm, const char* subject, const char* pattern);
+int preg_rematch(Preg* rm, const char* subject, const char* pattern,
+                 size_t offset, size_t deleted, size_t inserted);
 const char* preg_getmatch(const Preg* rm, int nmatch, int nsub);
 
 /* Replace functions */
 
 int preg_replace(Preg* rm, const char* subject, const char* pattern,
                  const char *rep);
+int preg_replace_cb(Preg* rm, const char* subject, const char* pattern,
+                    Preg_replace_cb cb, void* ctx);
+int preg_bufcat(Preg_buf* buf, const char* str, size_t len);
+int preg_addrule(Preg* rm, const char* pattern, const char* rep);
+void preg_clearrules(Preg* rm);
+int preg_replace_rules(Preg* rm, const char* subject);
 size_t preg_replen(const Preg* rm);
 const char* preg_getrep(const Preg* rm);
 
-/* Split function */
+/* Split functions */
 
 int preg_split(Preg* rm, const char* subject, const char* pattern);
-int preg_splitc(const Preg* rm);
+size_t preg_splitc(const Preg* rm);
 size_t preg_splitlen(const Preg* rm, int nmatch);
 const char* preg_getsplit(const Preg* rm, int nmatch);
+int preg_split_columns(Preg* rm, const char* subject, const char* pattern);
+size_t preg_recc(const Preg* rm);
+size_t preg_colc(const Preg* rm);
+const size_t* preg_fieldc(const Preg* rm);
+const size_t* preg_coloff(const Preg* rm, size_t col);
+const size_t* preg_collen(const Preg* rm, size_t col);
+
+/* Line functions */
+
+int preg_grep(Preg* rm, const char* subject, const char* pattern);
+size_t preg_grepline(const Preg* rm, int nmatch);
+int preg_lines(Preg* rm, const char* subject);
+size_t preg_linec(const Preg* rm);
+size_t preg_linestart(const Preg* rm, size_t line);
+void preg_linecol(const Preg* rm, size_t offset, size_t* line, size_t* col);
 
 /* Miscellaneous */
 
 char* preg_escape(const char* str, Preg_notation nota, size_t len);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
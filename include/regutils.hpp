@@ -0,0 +1,555 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef REGUTILS_HPP
+#define REGUTILS_HPP
+
+#if __cplusplus < 201703L
+#error "regutils.hpp requires C++17"
+#endif
+
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "regutils.h"
+
+/* A C++17 interface over libregutils. The results are string_views into the
+ * subject, built from the offsets of preg_start() and preg_end(), so the
+ * matched strings are never copied. The subject shall therefore outlive the
+ * results, which, as in C, are valid until the next operation of the handle */
+namespace regutils {
+
+// Iterates over the elements [0, size()) of a range that provides operator[]
+template <class Range, class Value>
+class Index_iterator {
+public:
+	using iterator_category = std::input_iterator_tag;
+	using value_type        = Value;
+	using difference_type   = std::ptrdiff_t;
+	using pointer           = void;
+	using reference         = Value;
+
+	Index_iterator(const Range* range, std::size_t i) : range_(range), i_(i) {}
+
+	Value operator*() const { return (*range_)[i_]; }
+	Index_iterator& operator++() { ++i_; return *this; }
+	Index_iterator operator++(int) { Index_iterator it = *this; ++i_; return it; }
+
+	bool operator==(const Index_iterator& it) const { return i_ == it.i_; }
+	bool operator!=(const Index_iterator& it) const { return i_ != it.i_; }
+
+private:
+	const Range* range_;
+	std::size_t i_;
+};
+
+/* A match and its submatches. Element 0 is the whole match. Submatches that
+ * did not participate in the match are empty views with a null data() */
+class Match {
+public:
+	using iterator = Index_iterator<Match, std::string_view>;
+
+	Match(const Preg* rm, const char* subject, std::size_t n)
+		: rm_(rm), subject_(subject), n_(n) {}
+
+	std::size_t size() const { return preg_subc(rm_) +1; }
+
+	std::ptrdiff_t so(std::size_t sub = 0) const
+	{
+		return preg_start(rm_, n_, sub);
+	}
+
+	std::ptrdiff_t eo(std::size_t sub = 0) const
+	{
+		return preg_end(rm_, n_, sub);
+	}
+
+	bool matched(std::size_t sub) const { return so(sub) != -1; }
+
+	std::string_view operator[](std::size_t sub) const
+	{
+		if (!matched(sub))
+			return std::string_view();
+
+		return std::string_view(subject_ +so(sub), eo(sub) -so(sub));
+	}
+
+	std::string_view str() const { return (*this)[0]; }
+
+	iterator begin() const { return iterator(this, 0); }
+	iterator end() const { return iterator(this, size()); }
+
+private:
+	const Preg* rm_;
+	const char* subject_;
+	std::size_t n_;
+};
+
+// The matches of the last match() or split()
+class Matches {
+public:
+	using iterator = Index_iterator<Matches, Match>;
+
+	Matches(const Preg* rm, const char* subject) : rm_(rm), subject_(subject) {}
+
+	std::size_t size() const { return preg_matc(rm_); }
+	bool empty() const { return !size(); }
+
+	Match operator[](std::size_t n) const { return Match(rm_, subject_, n); }
+
+	iterator begin() const { return iterator(this, 0); }
+	iterator end() const { return iterator(this, size()); }
+
+private:
+	const Preg* rm_;
+	const char* subject_;
+};
+
+/* The segments of the subject between the matches of the last split(). Empty
+ * segments are skipped, as in preg_split() */
+class Splits {
+public:
+	class iterator {
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type        = std::string_view;
+		using difference_type   = std::ptrdiff_t;
+		using pointer           = void;
+		using reference         = std::string_view;
+
+		iterator(const Preg* rm, std::string_view subject, std::size_t n)
+			: rm_(rm), subject_(subject), n_(n), so_(0)
+		{
+			skip();
+		}
+
+		std::string_view operator*() const { return seg_; }
+		iterator& operator++() { next(); skip(); return *this; }
+		iterator operator++(int) { iterator it = *this; ++*this; return it; }
+
+		bool operator==(const iterator& it) const { return n_ == it.n_; }
+		bool operator!=(const iterator& it) const { return n_ != it.n_; }
+
+	private:
+		// Moves past the segment that ends at match "n_"
+		void next()
+		{
+			if (n_ < preg_matc(rm_))
+				so_ = preg_end(rm_, n_, 0);
+			++n_;
+		}
+
+		// Stops at the next non-empty segment or at the end
+		void skip()
+		{
+			std::size_t matc = preg_matc(rm_);
+
+			for (; n_ <= matc; next()) {
+				if (n_ < matc)
+					seg_ = subject_.substr(so_, preg_start(rm_, n_, 0) -so_);
+				else
+					seg_ = subject_.substr(so_);
+
+				if (!seg_.empty())
+					return;
+			}
+		}
+
+		const Preg* rm_;
+		std::string_view subject_;
+		std::size_t n_;         // The segment ends at the start of match "n_"
+		std::size_t so_;        // Offset of the segment in the subject
+		std::string_view seg_;
+	};
+
+	Splits(const Preg* rm, std::string_view subject)
+		: rm_(rm), subject_(subject) {}
+
+	iterator begin() const { return iterator(rm_, subject_, 0); }
+	iterator end() const { return iterator(rm_, subject_, preg_matc(rm_) +1); }
+
+private:
+	const Preg* rm_;
+	std::string_view subject_;
+};
+
+namespace detail {
+
+// The characters preg_escape() escapes
+constexpr bool is_special(char c, Preg_notation nota)
+{
+	const char* specials = nota == PREG_BRE ? "^$.[*\\" : "^$.[()|*+?{\\";
+
+	for (; *specials; ++specials)
+		if (*specials == c)
+			return true;
+
+	return false;
+}
+
+template <std::size_t N>
+constexpr std::size_t length(const char (&s)[N])
+{
+	std::size_t len = 0;
+
+	while (len +1 < N && s[len])
+		++len;
+
+	return len;
+}
+
+/* Returns the index past the ']' that closes the bracket expression whose
+ * members start at "i", or 0 if the expression is not closed */
+constexpr std::size_t bracket_end(const char* s, std::size_t i, std::size_t len)
+{
+	if (i < len && s[i] == ']')
+		++i;
+
+	while (i < len && s[i] != ']') {
+		if (s[i] == '[' && i +1 < len && s[i +1] == ':') {
+			for (i += 2; i +1 < len && !(s[i] == ':' && s[i +1] == ']'); ++i)
+				;
+			if (i +1 >= len)
+				return 0;
+			i += 2;
+		}
+		else if (s[i] == '[' && i +1 < len && (s[i +1] == '.' || s[i +1] == '='))
+			return 0;
+		else
+			++i;
+	}
+
+	return i < len ? i +1 : 0;
+}
+
+}
+
+// A null-terminated string of at most N -1 characters built at compile time
+template <std::size_t N>
+struct Static_string {
+	char str[N] = {};
+	std::size_t len = 0;
+
+	constexpr const char* c_str() const { return str; }
+	constexpr std::string_view view() const { return std::string_view(str, len); }
+};
+
+/* "s" escaped at compile time, the same way preg_escape() escapes it */
+template <std::size_t N>
+constexpr Static_string<2 * N -1> escape(const char (&s)[N],
+                                         Preg_notation nota = PREG_ERE)
+{
+	Static_string<2 * N -1> res;
+	std::size_t len = detail::length(s);
+
+	for (std::size_t i = 0; i < len; ++i) {
+		if (detail::is_special(s[i], nota))
+			res.str[res.len++] = '\\';
+		res.str[res.len++] = s[i];
+	}
+
+	return res;
+}
+
+enum class Pattern_kind {
+	regex,
+	literal,                // No special characters, searched with PREG_LITERAL
+	byte_class              // Such as "," or "[ \t]+", searched without regcomp()
+};
+
+/* Classifies "s" as a pattern of the notation "nota" at compile time. Byte
+ * classes are recognized by their syntax. Whether the library can search them
+ * as such also depends on the locale and the flags, so they are classified
+ * only as a hint */
+template <std::size_t N>
+constexpr Pattern_kind classify(const char (&s)[N], Preg_notation nota = PREG_ERE)
+{
+	std::size_t len = detail::length(s);
+	std::size_t i = 0;
+
+	if (!len)
+		return Pattern_kind::regex;
+
+	while (i < len && !detail::is_special(s[i], nota))
+		++i;
+	if (i == len)
+		return Pattern_kind::literal;
+
+	if (s[0] == '[')
+		i = detail::bracket_end(s, len > 1 && s[1] == '^' ? 2 : 1, len);
+	else if (s[0] == '\\')
+		i = len > 1 && detail::is_special(s[1], nota) ? 2 : 0;
+	else
+		i = detail::is_special(s[0], nota) ? 0 : 1;
+
+	if (!i)
+		return Pattern_kind::regex;
+
+	if (nota == PREG_ERE && i < len && s[i] == '+')
+		++i;
+
+	return i == len ? Pattern_kind::byte_class : Pattern_kind::regex;
+}
+
+// A pattern classified at compile time
+template <std::size_t N>
+struct Static_pattern {
+	Static_string<N> text;
+	Pattern_kind kind = Pattern_kind::regex;
+
+	constexpr std::string_view view() const { return text.view(); }
+};
+
+template <std::size_t N>
+constexpr Static_pattern<N> pattern(const char (&s)[N],
+                                    Preg_notation nota = PREG_ERE)
+{
+	Static_pattern<N> res;
+
+	res.text.len = detail::length(s);
+	for (std::size_t i = 0; i < res.text.len; ++i)
+		res.text.str[i] = s[i];
+	res.kind = classify(s, nota);
+
+	return res;
+}
+
+// "s" as a literal string, whatever characters it contains
+template <std::size_t N>
+constexpr Static_pattern<N> literal(const char (&s)[N])
+{
+	Static_pattern<N> res = pattern(s);
+
+	if (res.text.len)
+		res.kind = Pattern_kind::literal;
+
+	return res;
+}
+
+/* A move-only owner of a Preg handle. The operations return the error codes
+ * of their C counterparts. The matched strings are taken from the subject, so
+ * PREG_NOSTRINGS is always set. Subjects that are std::string_views are
+ * copied to a buffer of the handle, as the C functions need them
+ * null-terminated, while the results still point into the original subject.
+ * Patterns and replacement strings are always copied, so that they may be
+ * given as string_views */
+class Handle {
+public:
+	Handle() : Handle(nullptr) {}
+	explicit Handle(const Preg_allocator& alloc) : Handle(&alloc) {}
+
+	~Handle() { preg_free(rm_); }
+
+	Handle(const Handle&) = delete;
+	Handle& operator=(const Handle&) = delete;
+
+	Handle(Handle&& h) noexcept
+		: rm_(h.rm_), subject_(h.subject_), subject_buf_(std::move(h.subject_buf_)),
+		  pattern_buf_(std::move(h.pattern_buf_)), rep_buf_(std::move(h.rep_buf_))
+	{
+		h.rm_ = nullptr;
+	}
+
+	Handle& operator=(Handle&& h) noexcept
+	{
+		swap(h);
+		return *this;
+	}
+
+	void swap(Handle& h) noexcept
+	{
+		std::swap(rm_, h.rm_);
+		std::swap(subject_, h.subject_);
+		subject_buf_.swap(h.subject_buf_);
+		pattern_buf_.swap(h.pattern_buf_);
+		rep_buf_.swap(h.rep_buf_);
+	}
+
+	// The underlying handle, for the functions this class does not wrap
+	Preg* get() const { return rm_; }
+
+	void setopt(Preg_opt opt, int value) { preg_setopt(rm_, opt, value); }
+	void delopt(Preg_opt opt, int value) { preg_delopt(rm_, opt, value); }
+
+	int errcode() const { return preg_errcode(rm_); }
+	const char* errmsg() const { return preg_errmsg(rm_); }
+
+	int match(const char* subject, std::string_view pattern)
+	{
+		return match_at(subject, subject, pattern);
+	}
+
+	int match(const std::string& subject, std::string_view pattern)
+	{
+		return match_at(subject.c_str(), subject, pattern);
+	}
+
+	int match(std::string_view subject, std::string_view pattern)
+	{
+		return match_at(cstr(subject, subject_buf_), subject, pattern);
+	}
+
+	int replace(const char* subject, std::string_view pattern,
+	            std::string_view rep)
+	{
+		return replace_at(subject, subject, pattern, rep);
+	}
+
+	int replace(const std::string& subject, std::string_view pattern,
+	            std::string_view rep)
+	{
+		return replace_at(subject.c_str(), subject, pattern, rep);
+	}
+
+	int replace(std::string_view subject, std::string_view pattern,
+	            std::string_view rep)
+	{
+		return replace_at(cstr(subject, subject_buf_), subject, pattern, rep);
+	}
+
+	/* Static patterns that are literals are searched with PREG_LITERAL, so
+	 * neither regcomp() nor any analysis of the pattern takes place */
+	template <class Subject, std::size_t N>
+	int match(const Subject& subject, const Static_pattern<N>& pattern)
+	{
+		Literal_flag flag(rm_, pattern.kind == Pattern_kind::literal);
+
+		return match(subject, pattern.view());
+	}
+
+	template <class Subject, std::size_t N>
+	int replace(const Subject& subject, const Static_pattern<N>& pattern,
+	            std::string_view rep)
+	{
+		Literal_flag flag(rm_, pattern.kind == Pattern_kind::literal);
+
+		return replace(subject, pattern.view(), rep);
+	}
+
+	template <class Subject, std::size_t N>
+	int split(const Subject& subject, const Static_pattern<N>& pattern)
+	{
+		return match(subject, pattern);
+	}
+
+	/* Finds the separators with preg_match(), so that the segments are
+	 * taken from the subject instead of being copied like preg_split() does.
+	 * splits() is valid only if it returns 0 */
+	int split(const char* subject, std::string_view pattern)
+	{
+		return match(subject, pattern);
+	}
+
+	int split(const std::string& subject, std::string_view pattern)
+	{
+		return match(subject, pattern);
+	}
+
+	int split(std::string_view subject, std::string_view pattern)
+	{
+		return match(subject, pattern);
+	}
+
+	std::size_t matc() const { return preg_matc(rm_); }
+	std::size_t subc() const { return preg_subc(rm_); }
+
+	Matches matches() const { return Matches(rm_, subject_.data()); }
+	Splits splits() const { return Splits(rm_, subject_); }
+
+	std::string_view rep() const
+	{
+		return std::string_view(preg_getrep(rm_), preg_replen(rm_));
+	}
+
+private:
+	// Sets PREG_LITERAL for the lifetime of the object
+	class Literal_flag {
+	public:
+		Literal_flag(Preg* rm, bool on) : rm_(rm), on_(on)
+		{
+			if (on_)
+				preg_setopt(rm_, PREG_UFLAGS, PREG_LITERAL);
+		}
+
+		~Literal_flag()
+		{
+			if (on_)
+				preg_delopt(rm_, PREG_UFLAGS, PREG_LITERAL);
+		}
+
+		Literal_flag(const Literal_flag&) = delete;
+		Literal_flag& operator=(const Literal_flag&) = delete;
+
+	private:
+		Preg* rm_;
+		bool on_;
+	};
+
+	explicit Handle(const Preg_allocator* alloc) : rm_(preg_init_ex(alloc))
+	{
+		if (!rm_)
+			throw std::bad_alloc();
+		preg_setopt(rm_, PREG_UFLAGS, PREG_NOSTRINGS);
+	}
+
+	/* "cs" is "subject" null-terminated. The results refer to "subject" */
+	int match_at(const char* cs, std::string_view subject,
+	             std::string_view pattern)
+	{
+		// preg_replace() drops PREG_NOSTRINGS when it needs the strings
+		preg_setopt(rm_, PREG_UFLAGS, PREG_NOSTRINGS);
+		subject_ = subject;
+		return preg_match(rm_, cs, cstr(pattern, pattern_buf_));
+	}
+
+	int replace_at(const char* cs, std::string_view subject,
+	               std::string_view pattern, std::string_view rep)
+	{
+		subject_ = subject;
+		return preg_replace(rm_, cs, cstr(pattern, pattern_buf_),
+		                    cstr(rep, rep_buf_));
+	}
+
+	// The string "s" null-terminated. "buf" keeps its capacity across calls
+	static const char* cstr(std::string_view s, std::string& buf)
+	{
+		buf.assign(s.data(), s.size());
+		return buf.c_str();
+	}
+
+	Preg* rm_;
+	std::string_view subject_; // The subject of the last operation
+	std::string subject_buf_;
+	std::string pattern_buf_;
+	std::string rep_buf_;
+};
+
+inline void swap(Handle& a, Handle& b) noexcept
+{
+	a.swap(b);
+}
+
+}
+
+#endif
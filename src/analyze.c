@@ -0,0 +1,368 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <regex.h>
+#include "analyze.h"
+
+/* A small recursive descent parser over the POSIX (and GNU) regex syntax.
+ * It does not validate the pattern, as it is only used on patterns that
+ * regcomp() already accepted. Whenever in doubt it underestimates the minimum
+ * and overestimates the maximum length */
+typedef struct {
+	const char* p;          // Current position in the pattern
+	int ere;                // Extended syntax
+	size_t charlen;         // Max length of one character in bytes
+	int icase;              // Case folding may change the character length
+	int nl;                 // REG_NEWLINE: "." and "[^...]" skip newlines
+	int newline;            // Becomes 1 when a match may contain a newline
+} Parser;
+
+// The match lengths of a subexpression
+typedef struct {
+	size_t min;
+	size_t max;
+	int bol;                // Becomes 1 when it starts with "^"
+} Range;
+
+static Range parse_alt(Parser* ps);
+static Range parse_seq(Parser* ps);
+static Range parse_atom(Parser* ps);
+static Range parse_quant(Parser* ps, Range r);
+static const char* skip_bracket(const char* p);
+static int bracket_newline(const char* p, const char* end, int nl);
+
+static Range range(size_t min, size_t max)
+{
+	Range r = { min, max, 0 };
+
+	return r;
+}
+
+/* Saturates on overflow. A saturated minimum is still a valid bound, as no
+ * subject is that long */
+static size_t add(size_t a, size_t b)
+{
+	if (a == ANALYZE_UNBOUNDED || b == ANALYZE_UNBOUNDED)
+		return ANALYZE_UNBOUNDED;
+
+	return a +b < a ? ANALYZE_UNBOUNDED : a +b;
+}
+
+static size_t mul(size_t a, size_t n)
+{
+	if (a == 0 || n == 0)
+		return 0;
+
+	if (a == ANALYZE_UNBOUNDED || n == ANALYZE_UNBOUNDED ||
+	    a > (ANALYZE_UNBOUNDED -1) / n)
+		return ANALYZE_UNBOUNDED;
+
+	return a * n;
+}
+
+static int at_alt(const Parser* ps)
+{
+	if (ps->ere)
+		return ps->p[0] == '|';
+
+	return ps->p[0] == '\\' && ps->p[1] == '|';
+}
+
+static int at_close(const Parser* ps)
+{
+	if (ps->ere)
+		return ps->p[0] == ')';
+
+	return ps->p[0] == '\\' && ps->p[1] == ')';
+}
+
+static Range parse_alt(Parser* ps)
+{
+	Range r;
+	Range alt;
+
+	r = parse_seq(ps);
+	while (at_alt(ps)) {
+		ps->p += ps->ere ? 1 : 2;
+		alt = parse_seq(ps);
+		if (alt.min < r.min)
+			r.min = alt.min;
+		if (alt.max > r.max)
+			r.max = alt.max;
+		r.bol = r.bol && alt.bol;
+	}
+
+	return r;
+}
+
+static Range parse_seq(Parser* ps)
+{
+	Range total = range(0, 0);
+	Range r;
+	int first = 1;
+
+	while (*ps->p && !at_alt(ps) && !at_close(ps)) {
+		// In the basic syntax "^" is an anchor only at the start
+		if (!ps->ere && first && *ps->p == '^') {
+			ps->p++;
+			total.bol = 1;
+			first = 0;
+			continue;
+		}
+
+		r = parse_quant(ps, parse_atom(ps));
+		if (first)
+			total.bol = r.bol;
+		first = 0;
+
+		total.min = add(total.min, r.min);
+		total.max = add(total.max, r.max);
+	}
+
+	return total;
+}
+
+static Range parse_atom(Parser* ps)
+{
+	const char* p = ps->p;
+	mbstate_t mbs;
+	Range r;
+	int n;
+
+	if (ps->ere && *p == '(') {
+		ps->p++;
+		r = parse_alt(ps);
+		if (*ps->p == ')')
+			ps->p++;
+		return r;
+	}
+
+	if (!ps->ere && p[0] == '\\' && p[1] == '(') {
+		ps->p += 2;
+		r = parse_alt(ps);
+		if (ps->p[0] == '\\' && ps->p[1] == ')')
+			ps->p += 2;
+		return r;
+	}
+
+	if (*p == '[') {
+		ps->p = skip_bracket(p +1);
+		if (bracket_newline(p +1, ps->p, ps->nl))
+			ps->newline = 1;
+		return range(1, ps->charlen);
+	}
+
+	// An escaped multibyte character is parsed as a literal one below
+	if (*p == '\\' && (unsigned char)p[1] < 0x80) {
+		ps->p += p[1] ? 2 : 1;
+
+		// Backreferences may be as long as the subject
+		if (p[1] >= '1' && p[1] <= '9')
+			return range(0, ANALYZE_UNBOUNDED);
+
+		// Word boundaries and buffer anchors. The latter depend on where the
+		// subject starts, so they are treated like newlines
+		if (p[1] && strchr("bB<>`'", p[1])) {
+			if (p[1] == '`' || p[1] == '\'')
+				ps->newline = 1;
+			return range(0, 0);
+		}
+
+		if (p[1] == 's' || p[1] == 'W')
+			ps->newline = 1;
+
+		return strchr("wWsS", p[1]) ? range(1, ps->charlen) : range(1, 1);
+	}
+	else if (*p == '\\')
+		p = ++ps->p;
+
+	if (ps->ere && (*p == '^' || *p == '$')) {
+		ps->p++;
+		r = range(0, 0);
+		r.bol = *p == '^';
+		return r;
+	}
+
+	// In the basic syntax these may be either anchors or literals
+	if (!ps->ere && (*p == '^' || *p == '$')) {
+		ps->p++;
+		return range(0, 1);
+	}
+
+	// A multibyte character is a single atom
+	n = 1;
+	if (ps->charlen > 1 && (unsigned char)*p >= 0x80) {
+		// Unlike mblen(), mbrlen() with a state of its own is thread-safe
+		memset(&mbs, 0, sizeof(mbs));
+		n = mbrlen(p, ps->charlen, &mbs);
+		if (n < 1)
+			n = 1;
+	}
+	ps->p += n;
+
+	if (*p == '\n' || (*p == '.' && !ps->nl))
+		ps->newline = 1;
+
+	if (*p == '.' || ps->icase)
+		return range(1, ps->charlen);
+
+	return range(n, n);
+}
+
+static Range parse_quant(Parser* ps, Range r)
+{
+	const char* p;
+	char* end;
+	size_t min;
+	size_t max;
+
+	for (;;) {
+		p = ps->p;
+
+		if (*p == '*' || (ps->ere && *p == '+') ||
+		    (!ps->ere && p[0] == '\\' && p[1] == '+')) {
+			ps->p += *p == '\\' ? 2 : 1;
+			if (*p == '*') {
+				r.min = 0;
+				r.bol = 0;
+			}
+			r.max = r.max ? ANALYZE_UNBOUNDED : 0;
+		}
+		else if ((ps->ere && *p == '?') ||
+		         (!ps->ere && p[0] == '\\' && p[1] == '?')) {
+			ps->p += *p == '\\' ? 2 : 1;
+			r.min = 0;
+			r.bol = 0;
+		}
+		else if ((ps->ere && *p == '{') ||
+		         (!ps->ere && p[0] == '\\' && p[1] == '{')) {
+			p += ps->ere ? 1 : 2;
+
+			min = max = strtoul(p, &end, 10);
+			if (*end == ',') {
+				p = end +1;
+				max = strtoul(p, &end, 10);
+				if (end == p)
+					max = ANALYZE_UNBOUNDED;
+			}
+
+			if (ps->ere && *end == '}')
+				ps->p = end +1;
+			else if (!ps->ere && end[0] == '\\' && end[1] == '}')
+				ps->p = end +2;
+			else
+				return range(0, ANALYZE_UNBOUNDED);
+
+			r.min = mul(r.min, min);
+			r.max = mul(r.max, max);
+			if (!min)
+				r.bol = 0;
+		}
+		else
+			return r;
+	}
+}
+
+/* Returns a pointer past the bracket expression that starts right after the
+ * '[' pointed by "p" */
+static const char* skip_bracket(const char* p)
+{
+	const char* end;
+
+	if (*p == '^')
+		p++;
+	if (*p == ']')
+		p++;
+
+	while (*p && *p != ']') {
+		if (p[0] == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+			char delim[3] = { p[1], ']', '\0' };
+
+			end = strstr(p +2, delim);
+			if (!end)
+				return p +strlen(p);
+			p = end +2;
+		}
+		else
+			p++;
+	}
+
+	return *p ? p +1 : p;
+}
+
+/* Returns 1 if the bracket expression between "p", right after the '[', and
+ * "end" may match a newline. "nl" is set when REG_NEWLINE is */
+static int bracket_newline(const char* p, const char* end, int nl)
+{
+	if (*p == '^')
+		return !nl;
+
+	for (; p < end; p++) {
+		// Collating elements and equivalence classes are not looked into
+		if (p[0] == '[' && (p[1] == '.' || p[1] == '='))
+			return 1;
+
+		if (!strncmp(p, "[:space:]", 9) || !strncmp(p, "[:cntrl:]", 9))
+			return 1;
+
+		// A range that starts at a control character may include it
+		if (*p == '\n' || ((unsigned char)*p < '\n' && p[1] == '-'))
+			return 1;
+	}
+
+	return 0;
+}
+
+void analyze_pattern(const char* pattern, int cflags, Analysis* an)
+{
+	Parser ps;
+	Range r;
+
+	ps.p = pattern;
+	ps.ere = cflags & REG_EXTENDED;
+	ps.charlen = MB_CUR_MAX;
+	ps.icase = ps.charlen > 1 && (cflags & REG_ICASE);
+	ps.nl = cflags & REG_NEWLINE;
+	ps.newline = 0;
+
+	r = parse_alt(&ps);
+
+	// An unbalanced closing parenthesis is a literal in some implementations.
+	// The alternatives that follow it are not parsed as such, so give up on
+	// the minimum
+	while (*ps.p) {
+		ps.p += ps.ere ? 1 : 2;
+		r.max = add(r.max, add(1, parse_alt(&ps).max));
+		r.min = 0;
+		r.bol = 0;
+		ps.newline = 1;
+	}
+
+	an->minlen  = r.min;
+	an->maxlen  = r.max;
+	an->bol     = r.bol;
+	an->empty   = r.min == 0;
+	an->newline = ps.newline;
+}
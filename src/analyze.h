@@ -0,0 +1,41 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include <stddef.h>
+
+#define ANALYZE_UNBOUNDED ((size_t)-1)
+
+/* Properties of every match of a pattern. The lengths are in bytes */
+typedef struct {
+	size_t minlen;          // Lower bound of the match length
+	size_t maxlen;          // Upper bound, or ANALYZE_UNBOUNDED if there is none
+	int bol;                // Becomes 1 when every match starts with "^"
+	int empty;              // Becomes 1 when a match may be empty
+	int newline;            // Becomes 1 when a match may contain a newline
+} Analysis;
+
+/* Analyzes "pattern", as compiled with "cflags" */
+void analyze_pattern(const char* pattern, int cflags, Analysis* an);
+
+#endif
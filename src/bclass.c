@@ -0,0 +1,361 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <locale.h>
+#include <langinfo.h>
+#include <regex.h>
+
+/* The nibble kernel of bclass_find() needs SSSE3. Unless the whole library is
+ * built for it, the kernel is built for it alone and used if the CPU has it */
+#if defined(__SSSE3__)
+#define NIBBLE_TARGET
+#define NIBBLE_SUPPORTED() 1
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+      __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define NIBBLE_TARGET __attribute__((target("ssse3")))
+#define NIBBLE_SUPPORTED() __builtin_cpu_supports("ssse3")
+#endif
+
+#if defined(NIBBLE_TARGET)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "bclass.h"
+
+static const char* ere_specials = "^$.[()|*+?{\\";
+static const char* bre_specials = "^$.[*\\";
+
+static const struct {
+	const char* name;
+	int (*is)(int);
+} char_classes[] = {
+	{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+	{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+	{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+	{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit }
+};
+
+static int bclass_locale_ok(int* multibyte);
+static const char* parse_bracket(unsigned char* map, const char* p, int mb);
+static int same_range_kind(int lo, int hi);
+static void bclass_tables(Bclass* bc);
+#if defined(NIBBLE_TARGET)
+static const char* nibble_find(const Bclass* bc, const char* s,
+                               const char* end);
+#endif
+
+/* Multibyte locales are only supported when they are UTF-8, since then no
+ * ASCII byte can be part of a multibyte character */
+static int bclass_locale_ok(int* multibyte)
+{
+	*multibyte = MB_CUR_MAX > 1;
+	if (!*multibyte)
+		return 1;
+
+	return strcmp(nl_langinfo(CODESET), "UTF-8") == 0;
+}
+
+/* Ranges are only accepted when their meaning does not depend on the
+ * collation order of the current locale */
+static int same_range_kind(int lo, int hi)
+{
+	if (lo > hi)
+		return 0;
+
+	return (isdigit(lo) && isdigit(hi)) ||
+	       (lo >= 'a' && hi <= 'z') ||
+	       (lo >= 'A' && hi <= 'Z');
+}
+
+/* Parses the bracket expression that starts right after the '[' pointed by
+ * "p" and sets the matching members of "map". Returns a pointer past the
+ * closing ']' or NULL if the expression is not supported */
+static const char* parse_bracket(unsigned char* map, const char* p, int mb)
+{
+	const char* end;
+	size_t len;
+	int lo, hi;
+	int c;
+	int i;
+
+	if (*p == ']')
+		map[(unsigned char)*p++] = 1;
+
+	while (*p && *p != ']') {
+		if (p[0] == '[' && p[1] == ':') {
+			// The classes of a multibyte locale have multibyte members too
+			if (mb)
+				return NULL;
+
+			end = strstr(p +2, ":]");
+			if (!end)
+				return NULL;
+
+			len = end -(p +2);
+			for (i = 0; i < sizeof(char_classes)/sizeof(*char_classes); ++i)
+				if (strlen(char_classes[i].name) == len &&
+				    !memcmp(char_classes[i].name, p +2, len))
+					break;
+
+			if (i == sizeof(char_classes)/sizeof(*char_classes))
+				return NULL;
+
+			for (c = 1; c < 256; ++c)
+				if (char_classes[i].is(c))
+					map[c] = 1;
+
+			p = end +2;
+			continue;
+		}
+
+		// Collating symbols and equivalence classes
+		if (p[0] == '[' && (p[1] == '.' || p[1] == '='))
+			return NULL;
+
+		lo = (unsigned char)*p++;
+		if (p[0] == '-' && p[1] && p[1] != ']') {
+			hi = (unsigned char)p[1];
+			if (!same_range_kind(lo, hi))
+				return NULL;
+
+			for (c = lo; c <= hi; ++c)
+				map[c] = 1;
+			p += 2;
+		}
+		else
+			map[lo] = 1;
+	}
+
+	if (*p != ']')
+		return NULL;
+
+	return p +1;
+}
+
+static void bclass_tables(Bclass* bc)
+{
+	int bit[16];
+	int nbit = 0;
+	int c;
+
+	memset(bc->lo, 0, sizeof(bc->lo));
+	memset(bc->hi, 0, sizeof(bc->hi));
+	memset(bit, -1, sizeof(bit));
+
+	for (c = 0; c < 256; ++c) {
+		if (!bc->map[c])
+			continue;
+
+		if (bit[c >> 4] == -1) {
+			// Each distinct high nibble takes one bit of the tables
+			if (nbit == 8)
+				return;
+			bit[c >> 4] = nbit++;
+			bc->hi[c >> 4] = 1 << bit[c >> 4];
+		}
+		bc->lo[c & 0x0f] |= 1 << bit[c >> 4];
+	}
+
+	bc->nibble = 1;
+}
+
+/* Checks whether "pattern", as compiled with "cflags", reduces to a byte class
+ * and in that case fills "bc". Returns 1 on success and 0 if the pattern is
+ * not a byte class */
+int bclass_compile(Bclass* bc, const char* pattern, int cflags)
+{
+	const char* specials;
+	const char* p = pattern;
+	int ere = cflags & REG_EXTENDED;
+	int neg = 0;
+	int mb;
+	int c;
+
+	if (!bclass_locale_ok(&mb))
+		return 0;
+
+	// Case folding may match multibyte characters too, such as the Kelvin sign
+	// for "k"
+	if (mb && (cflags & REG_ICASE))
+		return 0;
+
+	memset(bc, 0, sizeof(*bc));
+	specials = ere ? ere_specials : bre_specials;
+
+	if (*p == '[') {
+		if (p[1] == '^') {
+			neg = 1;
+			p++;
+		}
+		p = parse_bracket(bc->map, p +1, mb);
+		if (!p)
+			return 0;
+	}
+	else if (*p == '\\') {
+		if (!p[1] || !strchr(specials, p[1]))
+			return 0;
+		bc->map[(unsigned char)p[1]] = 1;
+		p += 2;
+	}
+	else if (*p && !strchr(specials, *p)) {
+		bc->map[(unsigned char)*p] = 1;
+		p++;
+	}
+	else
+		return 0;
+
+	if (ere && *p == '+') {
+		bc->plus = 1;
+		p++;
+	}
+
+	if (*p)
+		return 0;
+
+	if (cflags & REG_ICASE)
+		for (c = 1; c < 256; ++c)
+			if (bc->map[c])
+				bc->map[tolower(c)] = bc->map[toupper(c)] = 1;
+
+	if (neg) {
+		// A negated set would also match multibyte characters
+		if (mb)
+			return 0;
+
+		for (c = 0; c < 256; ++c)
+			bc->map[c] = !bc->map[c];
+
+		if (cflags & REG_NEWLINE)
+			bc->map['\n'] = 0;
+	}
+	bc->map[0] = 0;
+
+	for (c = 1; c < 256; ++c) {
+		if (!bc->map[c])
+			continue;
+
+		// Bytes above ASCII may be part of a multibyte character
+		if (mb && c >= 128)
+			return 0;
+
+		if (bc->nbyte < sizeof(bc->byte))
+			bc->byte[bc->nbyte] = c;
+		bc->nbyte++;
+	}
+
+	if (!bc->nbyte)
+		return 0;
+
+	bclass_tables(bc);
+
+	return 1;
+}
+
+/* Returns a pointer to the first member of the class in [s, end) or "end" if
+ * there is none */
+const char* bclass_find(const Bclass* bc, const char* s, const char* end)
+{
+	const char* res;
+
+	if (bc->nbyte == 1) {
+		res = memchr(s, bc->byte[0], end -s);
+		return res ? res : end;
+	}
+
+#if defined(__SSE2__)
+	if (bc->nbyte <= sizeof(bc->byte)) {
+		__m128i b[sizeof(bc->byte)];
+		int i;
+
+		for (i = 0; i < bc->nbyte; ++i)
+			b[i] = _mm_set1_epi8(bc->byte[i]);
+
+		for (; end -s >= 16; s += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)s);
+			__m128i eq = _mm_cmpeq_epi8(v, b[0]);
+			int mask;
+
+			for (i = 1; i < bc->nbyte; ++i)
+				eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, b[i]));
+
+			mask = _mm_movemask_epi8(eq);
+			if (mask)
+				return s +__builtin_ctz(mask);
+		}
+	}
+#endif
+#if defined(NIBBLE_TARGET)
+	if (bc->nbyte > (int)sizeof(bc->byte) && bc->nibble && NIBBLE_SUPPORTED())
+		s = nibble_find(bc, s, end);
+#endif
+
+	for (; s < end; ++s)
+		if (bc->map[(unsigned char)*s])
+			return s;
+
+	return end;
+}
+
+#if defined(NIBBLE_TARGET)
+/* Searches [s, end) 16 bytes at a time, looking up the low and the high nibble
+ * of every byte in the tables of bclass_tables(). Returns the first member of
+ * the class, or where fewer than 16 bytes are left */
+NIBBLE_TARGET
+static const char* nibble_find(const Bclass* bc, const char* s,
+                               const char* end)
+{
+	const __m128i lo = _mm_loadu_si128((const __m128i*)bc->lo);
+	const __m128i hi = _mm_loadu_si128((const __m128i*)bc->hi);
+	const __m128i low4 = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; end -s >= 16; s += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)s);
+		__m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, low4));
+		__m128i h = _mm_shuffle_epi8(hi,
+		                _mm_and_si128(_mm_srli_epi16(v, 4), low4));
+		int mask;
+
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), zero));
+		mask ^= 0xffff;
+		if (mask)
+			return s +__builtin_ctz(mask);
+	}
+
+	return s;
+}
+#endif
+
+/* Returns a pointer to the first byte in [s, end) that is not a member of the
+ * class or "end" if there is none */
+const char* bclass_span(const Bclass* bc, const char* s, const char* end)
+{
+	for (; s < end; ++s)
+		if (!bc->map[(unsigned char)*s])
+			return s;
+
+	return end;
+}
@@ -0,0 +1,44 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BCLASS_H
+#define BCLASS_H
+
+#include <stddef.h>
+
+/* A byte class is a regex pattern that reduces to "one byte from a fixed set"
+ * (e.g. "," or "[;|]") or "one or more bytes from a fixed set" (e.g.
+ * "[ \t]+"). Such patterns can be searched without calling regexec() */
+typedef struct {
+	unsigned char map[256]; // Non-zero for every member of the set
+	unsigned char byte[4];  // The members, if there are no more than four
+	int nbyte;              // Number of members of the set
+	int plus;               // Becomes 1 when a run of members is one match
+	unsigned char lo[16];   // Low nibble lookup table (see bclass_find())
+	unsigned char hi[16];   // High nibble lookup table
+	int nibble;             // Becomes 1 when the nibble tables are usable
+} Bclass;
+
+int bclass_compile(Bclass* bc, const char* pattern, int cflags);
+const char* bclass_find(const Bclass* bc, const char* s, const char* end);
+const char* bclass_span(const Bclass* bc, const char* s, const char* end);
+
+#endif
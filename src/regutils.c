@@ -24,21 +24,92 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <wchar.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "regutils.h"
+
+// The vectors allocate memory through the allocator of their handle
+#define VECTOR_MALLOC(ctx, size)       preg_malloc(ctx, size)
+#define VECTOR_REALLOC(ctx, ptr, size) preg_realloc(ctx, ptr, size)
+#define VECTOR_FREE(ctx, ptr)          preg_mfree(ctx, ptr)
 #include "vector.h"
+#include "bclass.h"
+#include "analyze.h"
 
 #define ERRCODE_POS(x) x -PREG_ERRCODE_START
 #define MEM_GROWTH_FACTOR 2
+#define MEM_ALIGN 16
+#define MAX_THREADS 64
+
+// Parallel replacement needs threads and searches bounded by REG_STARTEND
+#if defined(HAVE_PTHREAD) && defined(REG_STARTEND)
+#define PARALLEL_REPLACE 1
+#endif
+
+// The smallest part of the subject preg_replace() hands to a thread
+#define PART_MIN_SIZE (256 * 1024)
+
+// Matches per block of the PREG_COMPACT offsets
+#define PACK_BLOCK 64
+
+// A handle pool is split into 1 << POOL_SHARD_BITS shards (see Pool_shard)
+#define POOL_SHARD_BITS 3
+#define POOL_SHARDS (1 << POOL_SHARD_BITS)
+
+#ifdef HAVE_PTHREAD
+#define SHARD_LOCK(sh)   pthread_mutex_lock(&(sh)->lock)
+#define SHARD_UNLOCK(sh) pthread_mutex_unlock(&(sh)->lock)
+#else
+#define SHARD_LOCK(sh)
+#define SHARD_UNLOCK(sh)
+#endif
+
+/* The histograms of a profile are updated by the threads of a parallel
+ * replacement at once, so their counters are updated atomically, without
+ * locks. So is the idle count of a handle pool, which spans its shards */
+#ifdef __GNUC__
+#define ATOMIC_ADD(p, v) __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+#define ATOMIC_SUB(p, v) __atomic_fetch_sub(p, v, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(p)   __atomic_load_n(p, __ATOMIC_RELAXED)
+#define ATOMIC_CAS(p, old, v) \
+	__atomic_compare_exchange_n(p, old, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+#define ATOMIC_ADD(p, v) (*(p) += (v))
+#define ATOMIC_SUB(p, v) (*(p) -= (v))
+#define ATOMIC_LOAD(p)   (*(p))
+#define ATOMIC_CAS(p, old, v) (*(p) = (v), 1)
+#endif
+
+// The last subexpression PREG_SUBMASK can select, one per bit of an int
+#define SUBMASK_MAX 30
+
+/* The largest offset regexec() can report. regoff_t is a 32-bit int in glibc,
+ * so larger subjects are searched in windows (see window_exec()) */
+#ifndef REGOFF_MAX
+#define REGOFF_HALF ((regoff_t)1 << (sizeof(regoff_t) * CHAR_BIT -2))
+#define REGOFF_MAX ((size_t)((REGOFF_HALF -1) * 2 +1))
+#endif
 
 /* The max number with MAX_BREF_DIGITS shall not be greater than INT_MAX, as it
  * is used with atoi(). It shall also not be greater than the number of
  * subexpressions regcomp() supports. */
 #define MAX_BREF_DIGITS 1
 
+// The characters preg_escape() escapes
+static const char* bre_specials = "^$.[*\\";
+static const char* ere_specials = "^$.[()|*+?{\\";
+
 typedef enum {
 	PREG_MATCH = 0,
 	PREG_REPLACE,
-	PREG_SPLIT
+	PREG_SPLIT,
+	PREG_GREP,
+	PREG_COLUMNS
 } Preg_mode;
 
 typedef enum {
@@ -58,7 +129,12 @@ struct Preg_err {
 	{ PREG_INTERNAL_ERR, PREG_MEMFAIL,  "Failed to allocate memory" },
 	{ PREG_INTERNAL_ERR, PREG_BADMIN,   "Min should be zero or positive" },
 	{ PREG_INTERNAL_ERR, PREG_BADLIMIT, "Limit should be greater than -2" },
-	{ PREG_INTERDTL_ERR, PREG_BADBREF,  "Invalid backreference number" }
+	{ PREG_INTERDTL_ERR, PREG_BADBREF,  "Invalid backreference number" },
+	{ PREG_INTERNAL_ERR, PREG_MEMLIMIT, "Memory limit exceeded" },
+	{ PREG_INTERNAL_ERR, PREG_CBABORT,  "Aborted by a callback" },
+	{ PREG_INTERNAL_ERR, PREG_INPROGRESS, "Search in progress" },
+	{ PREG_INTERNAL_ERR, PREG_TOOLARGE, "Subject too large for the pattern" },
+	{ PREG_INTERNAL_ERR, PREG_TIMEDOUT, "Time limit exceeded" }
 };
 
 typedef struct {
@@ -67,6 +143,8 @@ typedef struct {
 
 typedef struct {
 	Preg_sub* match;
+	size_t cap;             // Matches "match" has room for
+	size_t dead;            // Arena bytes of the results preg_rematch() dropped
 } Preg_match;
 
 typedef struct {
@@ -79,6 +157,76 @@ typedef struct {
 	size_t size;
 } Preg_split;
 
+/* The fields of every column are stored consecutively, one column after
+ * another. Column "c" of record "r" is at [c * recc +r] */
+typedef struct {
+	size_t* fieldc;         // Number of fields of every record
+	size_t* off;            // Field offsets in the subject
+	size_t* len;            // Field lengths
+	size_t recc;            // Number of records
+	size_t colc;            // Number of columns
+} Preg_columns;
+
+// State of preg_split_columns() while scanning the subject
+typedef struct {
+	size_t nfields;         // Fields stored in "fields_sc"
+	size_t recc;            // Records stored in "recs_sc"
+	size_t colc;            // Max number of fields of a record
+	size_t cur;             // Number of fields of the current record
+	size_t start;           // Offset of the current record
+	size_t nl;              // Offset of the next newline
+	size_t len;             // Length of the subject
+} Columns_scan;
+
+// State of a search that ran out of its budget (see PREG_STEPBYTES)
+typedef struct {
+	size_t bytes;           // Bytes searched per call. Zero stands for unlimited
+	size_t execs;           // Searches per call. Zero stands for unlimited
+	const char* subject;    // The subject of the search. NULL if there is none
+	Preg_mode mode;         // The mode of the search
+	int skipped;            // Matches discarded so far due to PREG_MIN
+	size_t scan;            // Where a byte class search continues
+} Preg_step;
+
+/* A part of the subject of a parallel preg_replace(). Parts start at line
+ * starts, so a pattern whose matches contain no newline finds the same matches
+ * in them as in the whole subject */
+typedef struct {
+	Preg* rm;
+	const char* subject;
+	size_t len;             // Length of the subject
+	size_t from;            // The part is [from, to)
+	size_t to;
+	const String* rep;      // The parsed replacement string
+	const Bclass* bc;       // The pattern as a byte class, or NULL
+	regex_t comp;           // A copy of the pattern for this thread
+	int compd;              // Becomes 1 when "comp" gets compiled
+	regmatch_t* found;      // The matches, "subc" +1 offsets each
+	size_t matc;            // Number of matches
+	size_t size;            // Matches "found" has room for
+	size_t* held;           // Bytes the "found" of all parts take together
+	size_t budget;          // The limit of "held", or SIZE_MAX
+	size_t index;           // Index of the first match in the subject
+	size_t outlen;          // Length of the output of the part
+	size_t out;             // Offset of the output in the result
+	char* res;              // The result
+	size_t execs;           // regexec() calls
+	int err;
+} Part;
+
+static void* std_alloc(void* ctx, size_t size);
+static void* std_realloc(void* ctx, void* ptr, size_t size);
+static void  std_free(void* ctx, void* ptr);
+
+static inline void* preg_malloc(const Preg_allocator* al, size_t size);
+static inline void* preg_realloc(const Preg_allocator* al, void* ptr,
+                                 size_t size);
+static inline void  preg_mfree(const Preg_allocator* al, void* ptr);
+
+static Preg_allocator default_allocator = {
+	std_alloc, std_realloc, std_free, NULL
+};
+
 typedef struct {
 	size_t so;              // Backreference's start offset
 	int no;                 // Backreference's number
@@ -89,38 +237,289 @@ VECTOR_DEF_SRC (pvoid_vec, void*)
 VECTOR_DEF_HEAD(bref_vec, Bref)
 VECTOR_DEF_SRC (bref_vec, Bref)
 
+/* A rule of preg_replace_rules() */
+typedef struct {
+	regex_t comp;           // The compiled pattern
+	int cflags;             // The flags the pattern is compiled with
+	size_t subc;            // Number of subexpressions of the pattern
+	String rep;             // The parsed replacement string
+	bref_vec bref;          // Backreferences of "rep"
+	regmatch_t* match;      // The next match of the rule
+	int found;              // 1 if "match" is set, -1 if there are no more
+	Bclass bc;              // The pattern as a byte class
+	int bclass;             // Becomes 1 when "bc" is usable
+	Preg_profile* prof;     // Its profile, if PREG_PROFILE was set when added
+} Rule;
+
+// How a pattern is searched without regexec()
+typedef enum {
+	FIXED_NONE = 0,
+	FIXED_BCLASS,           // A byte class, such as "," or "[ \t]+"
+	FIXED_LITERAL           // A literal string (see PREG_LITERAL)
+} Fixed_kind;
+
+typedef struct {
+	Fixed_kind kind;
+	Bclass bc;              // The byte class
+	const char* str;        // The literal string
+	size_t len;             // Its length
+} Fixed;
+
+/* A pattern compiled by preg_preload() */
+typedef struct {
+	char* pattern;
+	int cflags;
+	int err;                // regcomp()'s error. "comp" is usable only if 0
+	regex_t comp;
+	Analysis info;          // Properties of the matches of "comp"
+	Preg_profile* prof;     // Its profile, if PREG_PROFILE was set when loaded
+} Preload;
+
+// The share of the patterns of preg_preload() that a thread compiles
+typedef struct {
+	Preload** pl;           // Every "stride"th entry of "pl" is compiled
+	size_t n;               // Number of entries of "pl"
+	size_t stride;
+} Preload_job;
+
+/* The idle handles of a pool are split into shards, each with a lock of its
+ * own. A thread returns its handles to the shard its id hashes to and looks
+ * there first for one, so threads seldom wait for each other, and a thread
+ * usually gets back the handle it returned last, whose memory is still warm */
+typedef struct {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+	Preg** idle;            // The idle handles, the one returned last on top
+	size_t n;               // Number of idle handles
+} Pool_shard;
+
+struct Preg_pool {
+	Preg_allocator alloc;   // The allocator of the pool and its handles
+	size_t max;             // Idle handles the pool keeps, in any shard
+	size_t idle;            // Idle handles in all the shards
+	Pool_shard shard[POOL_SHARDS];
+};
+
+/* The results of an operation are allocated from an arena that is reset by the
+ * next operation. Whatever did not fit in the main block is allocated in extra
+ * blocks, which are merged into the main block on reset. Thus, after warm-up,
+ * similar operations allocate nothing */
+typedef struct {
+	void* mem;              // The main block
+	size_t size;            // Main block's size
+	size_t used;            // Bytes of the main block handed out
+	pvoid_vec extra;        // Blocks allocated when the main block was full
+	size_t extra_size;      // Total size of the extra blocks
+} Arena;
+
+// Grow-only memory reused across operations
+typedef struct {
+	void* mem;
+	size_t size;
+} Scratch;
+
+/* With PREG_COMPACT, the offsets are packed in blocks of PACK_BLOCK matches.
+ * The record of a match holds its start, relative to "base", and its length.
+ * Then, for every subexpression, its start relative to the match plus one, or
+ * 0 if it did not participate, and its length. The fields are "wso" and "wlen"
+ * bytes wide, the fewest of 1, 2, 4 or 8 that fit every record of the block,
+ * so that any match is found without decoding the ones before it */
+typedef struct {
+	size_t base;            // Start of the first match of the block
+	size_t pos;             // Where the records begin in "pack_sc"
+	size_t rec;             // Size of a record
+	unsigned char wso;
+	unsigned char wlen;
+} Pack_block;
+
 struct Preg {
 	regex_t comp;           // The compiled regex pattern
 	int compd;              // Becomes 1 when comp gets compiled successfully
+	const regex_t* re;      // The pattern in use: "comp" or a preloaded one
+	Fixed_kind fixed;       // How "pat_sc" is searched when "re" is NULL
 	regmatch_t** offset;    // Matrix that holds the matched offsets
 	size_t offset_size;     // offset's size
+	size_t offset_subc;     // Subexpressions the offset rows have room for
+	size_t* offset_base;    // The offset every row counts from, when "wide"
+	int wide;               // Becomes 1 when the subject exceeds REGOFF_MAX
+	size_t sublen;          // Length of the subject of the results
+	int packed;             // Becomes 1 when the offsets are packed instead
+	size_t pack_len;        // Bytes of "pack_sc" in use
 	size_t matc;            // Match count
 	size_t subc;            // Number of subexpressions in the regex pattern
+	unsigned sel;           // The subexpressions the results hold. 0 for all
+	unsigned char subcol[SUBMASK_MAX +1]; // Columns of the ones in "sel"
+	size_t subn;            // Columns of the offset rows in use
+	size_t execn;           // Subexpressions regexec() reports
+	int submask;            // The subexpressions PREG_SUBMASK selects
 	int uflags;             // libregutils' flags
 	int cflags;             // Regcomp's flags
 	int min;                // The number of the minimum match to be returned
 	int limit;              // The max number of matches to be returned
-	pvoid_vec* mpools;      // Vector of allocated memory pools
+	size_t maxmem;          // Memory budget. Zero stands for unlimited
+	int threads;            // Threads of preg_replace(). 0 or 1 for none
+	uint64_t timeout;       // Time budget in ns. Zero stands for unlimited
+	uint64_t deadline;      // When the operation in progress times out, or 0
+	Preg_cursor from;       // Where the next search resumes from
+	int resume;             // Becomes 1 when "from" is set by the user
+	Preg_cursor next;       // Where the last search stopped
+	size_t start;           // The offset where the last search started
+	size_t* lines;          // Line index: the start offsets of the lines
+	size_t linec;           // Number of lines in the line index
+	size_t lines_size;      // lines' size
+	pvoid_vec* mpools;      // Vector of memory pools held by the handle
+	Arena results;          // Memory of the results of the last operation
+	Scratch match_sc;       // regexec()'s match array
+	Scratch found_sc;       // Matches rescanned by preg_rematch()
+	Scratch rep_sc;         // The parsed replacement string
+	Scratch pat_sc;         // The pattern "comp" was compiled from
+	Scratch out_sc;         // The output of preg_replace_cb()
+	Scratch fields_sc;      // Fields found by preg_split_columns()
+	Scratch recs_sc;        // Field counts of preg_split_columns()
+	Scratch lit_sc;         // An escaped PREG_LITERAL pattern
+	Scratch pack_sc;        // Packed offsets of the complete blocks
+	Scratch blocks_sc;      // The blocks of "pack_sc"
+	Scratch pend_sc;        // Offsets of the matches of the last, open block
+	int comp_cflags;        // The flags "comp" was compiled with
+	Analysis info;          // Properties of the matches of "comp"
+	bref_vec bref;          // Backreferences of the replacement string
+	pvoid_vec rules;        // The rules of preg_replace_rules()
+	Preload** preload;      // Hash table of the patterns of preg_preload()
+	size_t preload_size;    // preload's size, a power of two
+	size_t preloadc;        // Number of preloaded patterns
+	Preg_profile* prof;     // The profile of "re" when PREG_PROFILE is set
+	pvoid_vec profiles;     // The profiles of PREG_PROFILE, by first use
+	Preg_profile** prof_table; // Hash table of "profiles"
+	size_t prof_size;       // prof_table's size, a power of two
 	Preg_err err;           // Error
 	Preg_mode mode;         // The regex mode
+	Preg_stats stats;       // Performance counters
+	Preg_step step;         // Budget and state of a search in progress
+	Preg_allocator alloc;   // The allocator of every memory the handle uses
 	union {
 		Preg_match matches; // Array of regex matches
 		String rep;         // Replaced string
 		Preg_split splits;  // Split string
+		Preg_columns cols;  // Split records
 	};
 };
 
+static int   mem_reserve(Preg* rm, size_t size);
+static void  mem_count(Preg* rm, size_t size);
+static void* mem_block(Preg* rm, size_t size);
 static void* mem_init(Preg* rm, size_t size);
+static void  mem_reset(Preg* rm);
 static void* mem_alloc(void** mem, size_t size);
-
-static int preg_offset(Preg* rm, const char* subject, const char* pattern);
+static void* scratch_get(Preg* rm, Scratch* sc, size_t size);
+
+static void handle_reset(Preg* rm);
+static Pool_shard* pool_shard(Preg_pool* pool);
+static void pool_destroy(Preg_pool* pool, size_t shards);
+
+static uint64_t preg_clock(void);
+static void timeout_start(Preg* rm);
+static int preg_comp(Preg* rm, const char* pattern, int cflags);
+static int preg_exec(Preg* rm, const char* subject, regmatch_t* match,
+                     int eflags);
+static int preg_exec_re(Preg* rm, const regex_t* re, Preg_profile* prof,
+                        size_t nmatch, const char* subject, regmatch_t* match,
+                        int eflags);
+static void sub_check(regmatch_t* match, size_t nmatch);
+static Preg_profile* profile_get(Preg* rm, const char* pattern, int cflags);
+static int profile_use(Preg* rm);
+static void hist_add(Preg_histogram* h, unsigned long long val);
+static size_t profile_print(char* res, size_t size, const Preg* rm,
+                            Preg_format format);
+static void hist_print(char* res, size_t size, size_t* len,
+                       const char* name, const Preg_histogram* h,
+                       Preg_format format);
+static void print_out(char* res, size_t size, size_t* len, const char* fmt,
+                      ...);
+
+static int preg_offset(Preg* rm, const char* subject, const char* pattern,
+                       int submask);
+static int match_strings(Preg* rm, const char* subject, const char* pattern,
+                         int submask);
 static int preg_offset_alloc(Preg* array);
+static int preg_offset_fixed(Preg* rm, const char* subject, size_t len,
+                             const Fixed* fx);
+static int fixed_set(Preg* rm, const char* pattern, Fixed_kind kind);
+static const char* fixed_find(const Fixed* fx, const char* s, const char* lim,
+                              const char* end);
+static const char* fixed_next(const Fixed* fx, const char* so,
+                              const char* end);
+static const char* literal_escape(Preg* rm, const char* pattern);
+static size_t escape(char* res, const char* str, size_t len,
+                     const char* specials);
+static int offset_exec(Preg* rm, const char* subject, size_t len, size_t* ro,
+                       regmatch_t* match, int* eflags, int* adjacent);
+static int window_exec(Preg* rm, const char* s, size_t rest, regmatch_t* match,
+                       int eflags, size_t* win);
+static int offset_store(Preg* rm, size_t i, const regmatch_t* match,
+                        size_t base);
+static int offset_widen(Preg* rm);
+static void sub_select(Preg* rm);
+static void sub_gather(const Preg* rm, regmatch_t* match);
+static inline int sub_selected(const Preg* rm, size_t* nsub);
+static const regmatch_t* offset_row(Preg* rm, size_t i, size_t* base);
+static int pack_add(Preg* rm, size_t i, const regmatch_t* match, size_t base);
+static int pack_flush(Preg* rm, size_t nblock);
+static size_t pack_off(const Preg* rm, size_t nmatch, size_t nsub, int end);
+static unsigned char pack_width(size_t max);
+static void pack_put(unsigned char* p, unsigned char width, size_t val);
+static size_t pack_get(const unsigned char* p, unsigned char width);
+static void offset_advance(const char* subject, size_t* ro,
+                           const regmatch_t* match, int* eflags, int* adjacent);
+static size_t char_len(const char* s);
+static int step_continues(const Preg* rm, const char* subject,
+                          const char* pattern, int literal);
+static int step_spent(const Preg* rm, size_t bytes, size_t execs);
+static const char* step_end(const Preg* rm, const char* begin, const char* s,
+                            const char* end);
+
+static size_t sub_len(const Preg* rm, size_t nmatch, size_t nsub);
+static size_t matches_size(const Preg* rm, size_t from, size_t to);
+static void matches_copy(const Preg* rm, const char* subject, Preg_sub* match,
+                         size_t from, size_t to, void** mem);
+static int rematch_full(Preg* rm, const char* subject, const char* pattern);
+static int rematch_scan(Preg* rm, const char* subject, size_t ro, size_t keep,
+                        size_t offset, size_t deleted, size_t inserted);
+
+static int columns_field(Preg* rm, Columns_scan* cs, size_t off, size_t len);
+static int columns_record(Preg* rm, Columns_scan* cs, size_t next);
+static int columns_segment(Preg* rm, Columns_scan* cs, const char* subject,
+                           size_t from, size_t to);
+static void columns_nextnl(Columns_scan* cs, const char* subject, size_t from);
+
+static int lines_append(Preg* rm, size_t start);
+static int lines_scan(Preg* rm, const char* subject, size_t from, size_t to,
+                      size_t len);
 
 static int parse_rep(const char* rep, String* nrep, bref_vec* brvec);
-static String
-assemble(Preg* rm, const char* subject, String* rep, bref_vec* bref);
-static int
-copy_rep(Preg* rm, int nmatch, String* rep, bref_vec* bref, void* mem);
+static int assemble(Preg* rm, const char* subject, String* rep,
+                    bref_vec* bref, String* res);
+static size_t
+copy_rep(Preg* rm, size_t nmatch, String* rep, bref_vec* bref, void* mem);
+static int buf_reserve(Preg_buf* buf, size_t len);
+#ifdef PARALLEL_REPLACE
+static int replace_parallel(Preg* rm, const char* subject, const char* pattern,
+                            const String* rep, String* res, char* errdtls);
+static void run_parts(Part* parts, size_t n, void* (*fn)(void*));
+static void* part_search(void* arg);
+static int part_add(Part* pt, regmatch_t** match);
+static void part_count(Part* pt, const regmatch_t* match);
+static void* part_assemble(void* arg);
+#endif
+static Preload* preload_find(const Preg* rm, const char* pattern, int cflags);
+static Preload* preload_add(Preg* rm, const Preg_pattern* pat);
+static int preload_grow(Preg* rm, size_t n);
+static size_t preload_hash(const char* pattern, int cflags);
+static void* preload_comp(void* arg);
+static void rule_free(Preg* rm, Rule* rule);
+static int rule_exec(Preg* rm, Rule* rule, const char* subject, size_t ro,
+                     size_t len);
+static int rule_copy(Preg_buf* buf, const char* subject, const Rule* rule);
 
 static void preg_set_mode(Preg* rm, Preg_mode mode);
 static int  preg_checkopt(Preg* rm);
@@ -131,21 +530,197 @@ static void preg_set_internal_error(Preg* rm, int err);
 static int  preg_set_external_error(Preg* rm, int err);
 static int  preg_set_interdtl_error(Preg* rm, int err, va_list args);
 
-static void* mem_init(Preg* rm, size_t size)
+static void* std_alloc(void* ctx, size_t size)
+{
+	(void)ctx;
+
+	return malloc(size);
+}
+
+static void* std_realloc(void* ctx, void* ptr, size_t size)
+{
+	(void)ctx;
+
+	return realloc(ptr, size);
+}
+
+static void std_free(void* ctx, void* ptr)
+{
+	(void)ctx;
+
+	free(ptr);
+}
+
+static inline void* preg_malloc(const Preg_allocator* al, size_t size)
+{
+	return al->alloc(al->ctx, size);
+}
+
+static inline void* preg_realloc(const Preg_allocator* al, void* ptr,
+                                 size_t size)
+{
+	return al->realloc(al->ctx, ptr, size);
+}
+
+static inline void preg_mfree(const Preg_allocator* al, void* ptr)
+{
+	if (ptr)
+		al->free(al->ctx, ptr);
+}
+
+/* Sets the allocator used by the handles initialized with preg_init() and by
+ * preg_escape(). A NULL "alloc" restores the standard library allocator.
+ * The allocator is a plain global, so it shall be set before other threads
+ * use the library */
+void preg_set_default_allocator(const Preg_allocator* alloc)
+{
+	if (alloc)
+		default_allocator = *alloc;
+	else {
+		default_allocator.alloc   = std_alloc;
+		default_allocator.realloc = std_realloc;
+		default_allocator.free    = std_free;
+		default_allocator.ctx     = NULL;
+	}
+}
+
+/* Returns the bytes of the handle that count against PREG_MAXMEM */
+static size_t mem_used(const Preg* rm)
+{
+	return rm->stats.pool_retained +rm->offset_size * sizeof(regmatch_t*) +
+	       (rm->offset_base ? rm->offset_size * sizeof(size_t) : 0) +
+	       rm->lines_size * sizeof(size_t) +rm->pack_sc.size +
+	       rm->blocks_sc.size;
+}
+
+/* Checks whether "size" more bytes fit in the memory budget of the handle.
+ * Shall be called before the allocation takes place. Returns 0 if they fit
+ * and PREG_MEMLIMIT if they don't */
+static int mem_reserve(Preg* rm, size_t size)
+{
+	size_t used;
+
+	if (!rm->maxmem)
+		return 0;
+
+	// The free space of the arena is already accounted for
+	if (rm->results.size -rm->results.used >= size)
+		return 0;
+
+	used = mem_used(rm);
+	if (size > rm->maxmem || used > rm->maxmem -size)
+		return PREG_MEMLIMIT;
+
+	return 0;
+}
+
+static void mem_count(Preg* rm, size_t size)
+{
+	rm->stats.pool_allocated += size;
+	rm->stats.pool_retained  += size;
+	rm->stats.pool_blocks++;
+	if (rm->stats.pool_retained > rm->stats.peak_mem)
+		rm->stats.peak_mem = rm->stats.pool_retained;
+}
+
+/* Allocates a memory pool that is held until the handle is freed */
+static void* mem_block(Preg* rm, size_t size)
 {
 	void* mem;
 	int err;
 
-	mem = malloc(size);
+	mem = preg_malloc(&rm->alloc, size);
 	if (!mem)
 		return NULL;
 
 	err = pvoid_vec_append(rm->mpools, mem);
 	if (err) {
-		free(mem);
+		preg_mfree(&rm->alloc, mem);
+		return NULL;
+	}
+
+	mem_count(rm, size);
+
+	return mem;
+}
+
+/* Allocates memory for the results of the current operation */
+static void* mem_init(Preg* rm, size_t size)
+{
+	Arena* ar = &rm->results;
+	void* mem;
+	int err;
+
+	size = size ? (size +MEM_ALIGN -1) & ~(size_t)(MEM_ALIGN -1) : MEM_ALIGN;
+
+	if (ar->size -ar->used >= size) {
+		mem = ar->mem +ar->used;
+		ar->used += size;
+		return mem;
+	}
+
+	mem = preg_malloc(&rm->alloc, size);
+	if (!mem)
+		return NULL;
+
+	err = pvoid_vec_append(&ar->extra, mem);
+	if (err) {
+		preg_mfree(&rm->alloc, mem);
 		return NULL;
 	}
 
+	ar->extra_size += size;
+	mem_count(rm, size);
+
+	return mem;
+}
+
+/* Releases the results of the previous operation */
+static void mem_reset(Preg* rm)
+{
+	Arena* ar = &rm->results;
+	size_t need = ar->used +ar->extra_size;
+	int i;
+
+	if (ar->extra.n) {
+		for (i = 0; i < ar->extra.n; ++i)
+			preg_mfree(&rm->alloc, ar->extra.entry[i]);
+
+		rm->stats.pool_retained -= ar->extra_size +ar->size;
+		rm->stats.pool_blocks   -= ar->extra.n +(ar->mem != NULL);
+		ar->extra.n = 0;
+		ar->extra_size = 0;
+
+		// Replace the main block with one that fits all of the results
+		preg_mfree(&rm->alloc, ar->mem);
+		ar->size = 0;
+		ar->mem = preg_malloc(&rm->alloc, need);
+		if (ar->mem) {
+			ar->size = need;
+			mem_count(rm, need);
+		}
+	}
+
+	ar->used = 0;
+}
+
+static void* scratch_get(Preg* rm, Scratch* sc, size_t size)
+{
+	void* mem;
+
+	if (size <= sc->size)
+		return sc->mem;
+
+	if (size < sc->size * MEM_GROWTH_FACTOR)
+		size = sc->size * MEM_GROWTH_FACTOR;
+
+	mem = preg_realloc(&rm->alloc, sc->mem, size);
+	if (!mem)
+		return NULL;
+
+	sc->mem  = mem;
+	sc->size = size;
+
 	return mem;
 }
 
@@ -166,23 +741,84 @@ inline size_t preg_subc(const Preg* rm)
 	return rm->subc;
 }
 
+/* The offsets of a subject larger than REGOFF_MAX are truncated, as regoff_t
+ * cannot hold them. preg_start() and preg_end() report them as they are */
 inline regoff_t preg_so(const Preg* rm, int nmatch, int nsub)
 {
-	return rm->offset[nmatch][nsub].rm_so;
+	return preg_start(rm, nmatch, nsub);
 }
 
 inline regoff_t preg_eo(const Preg* rm, int nmatch, int nsub)
 {
-	return rm->offset[nmatch][nsub].rm_eo;
+	return preg_end(rm, nmatch, nsub);
+}
+
+/* Returns the start offset of the subexpression "nsub" of the match "nmatch",
+ * or -1 if the subexpression did not participate in the match or was left
+ * out by PREG_SUBMASK */
+ssize_t preg_start(const Preg* rm, size_t nmatch, size_t nsub)
+{
+	regoff_t so;
+
+	if (rm->sel && !sub_selected(rm, &nsub))
+		return -1;
+
+	if (rm->packed)
+		return pack_off(rm, nmatch, nsub, 0);
+
+	so = rm->offset[nmatch][nsub].rm_so;
+	if (so == -1 || !rm->wide)
+		return so;
+
+	return rm->offset_base[nmatch] +so;
+}
+
+// Same as preg_start(), for the end offset
+ssize_t preg_end(const Preg* rm, size_t nmatch, size_t nsub)
+{
+	regoff_t eo;
+
+	if (rm->sel && !sub_selected(rm, &nsub))
+		return -1;
+
+	if (rm->packed)
+		return pack_off(rm, nmatch, nsub, 1);
+
+	eo = rm->offset[nmatch][nsub].rm_eo;
+	if (eo == -1 || !rm->wide)
+		return eo;
+
+	return rm->offset_base[nmatch] +eo;
 }
 
 inline const char* preg_getmatch(const Preg* rm, int nmatch, int nsub)
 {
-	return rm->matches.match[nmatch].sub[nsub];
+	size_t col = nsub;
+
+	if (rm->sel && !sub_selected(rm, &col))
+		return "";
+
+	return rm->matches.match[nmatch].sub[col];
 }
 
 inline size_t preg_matchlen(const Preg* rm, int nmatch, int nsub)
 {
+	size_t col = nsub;
+
+	if (rm->sel && !sub_selected(rm, &col))
+		return 0;
+
+	return sub_len(rm, nmatch, col);
+}
+
+/* Same as preg_matchlen(), for any number of matches. "nsub" is a column of
+ * the offset rows */
+static size_t sub_len(const Preg* rm, size_t nmatch, size_t nsub)
+{
+	if (rm->packed)
+		return pack_off(rm, nmatch, nsub, 1) -
+		       pack_off(rm, nmatch, nsub, 0);
+
 	return rm->offset[nmatch][nsub].rm_eo - rm->offset[nmatch][nsub].rm_so;
 }
 
@@ -196,7 +832,7 @@ inline size_t preg_replen(const Preg* rm)
 	return rm->rep.len;
 }
 
-inline int preg_splitc(const Preg* rm)
+inline size_t preg_splitc(const Preg* rm)
 {
 	return rm->splits.size;
 }
@@ -211,538 +847,3825 @@ inline size_t preg_splitlen(const Preg* rm, int nmatch)
 	return rm->splits.split[nmatch].len;
 }
 
-inline const char* preg_errmsg(const Preg* rm)
+inline size_t preg_recc(const Preg* rm)
 {
-	return rm->err.errmsg;
+	return rm->cols.recc;
 }
 
-inline int preg_errcode(const Preg* rm)
+inline size_t preg_colc(const Preg* rm)
 {
-	return rm->err.errcode;
+	return rm->cols.colc;
 }
 
-Preg* preg_init(void)
+inline const size_t* preg_fieldc(const Preg* rm)
 {
-	Preg* rm;
+	return rm->cols.fieldc;
+}
 
-	rm = calloc(1, sizeof(Preg));
-	if (rm) {
-		// NULL may not be represented as zeroed memory
-		rm->offset = NULL;
-		rm->cflags = REG_EXTENDED;
-		rm->limit  = -1;
-		rm->err	   = internal_errors[ERRCODE_POS(PREG_NOACTION)];
-		rm->mode   = -1;
-		rm->mpools = pvoid_vec_init();
-	}
+inline const size_t* preg_coloff(const Preg* rm, size_t col)
+{
+	return &rm->cols.off[col * rm->cols.recc];
+}
 
-	return rm;
+inline const size_t* preg_collen(const Preg* rm, size_t col)
+{
+	return &rm->cols.len[col * rm->cols.recc];
 }
 
-void preg_free(Preg* rm)
+void preg_cursor(const Preg* rm, Preg_cursor* cur)
 {
-	if (rm) {
-		if (rm->compd)
-			regfree(&rm->comp);
+	*cur = rm->next;
+}
 
-		pvoid_vec_free(rm->mpools, free);
-		free(rm->offset);
-		free(rm);
+/* The next search will resume from "cur" instead of the start of the
+ * subject. A NULL "cur" cancels a previous call */
+void preg_setcursor(Preg* rm, const Preg_cursor* cur)
+{
+	if (cur) {
+		rm->from = *cur;
+		rm->resume = 1;
 	}
+	else
+		rm->resume = 0;
 }
 
-void preg_set_mode(Preg* rm, Preg_mode mode)
+inline size_t preg_linec(const Preg* rm)
 {
-	rm->mode = mode;
-	switch (rm->mode) {
-	case PREG_MATCH:
-		rm->matches.match = NULL;
-		break;
-	case PREG_REPLACE:
-		rm->rep.str = NULL;
-		rm->rep.len = 0;
-		break;
-	case PREG_SPLIT:
-		rm->splits.split = NULL;
-		rm->splits.size = 0;
-	}
+	return rm->linec;
 }
 
-void preg_setopt(Preg* rm, Preg_opt opt, int value)
+inline size_t preg_linestart(const Preg* rm, size_t line)
 {
-	switch (opt) {
-	case PREG_CFLAGS:
-		rm->cflags |= value;
-		break;
-	case PREG_UFLAGS:
-		rm->uflags |= value;
-		break;
-	case PREG_MIN:
-		rm->min = value;
-		break;
-	case PREG_LIMIT:
-		rm->limit = value;
-	}
+	return rm->lines[line];
 }
 
-void preg_delopt(Preg* rm, Preg_opt opt, int value)
+/* Maps "offset" to a line and a byte column using the line index */
+void preg_linecol(const Preg* rm, size_t offset, size_t* line, size_t* col)
 {
-	switch (opt) {
-	case PREG_CFLAGS:
-		rm->cflags &= ~value;
-	case PREG_UFLAGS:
-		rm->uflags &= ~value;
-	default:
-		break;
+	size_t lo = 0;
+	size_t hi = rm->linec;
+	size_t mid;
+
+	// Find the last line starting at or before "offset"
+	while (hi -lo > 1) {
+		mid = lo +(hi -lo) / 2;
+		if (rm->lines[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
 	}
+
+	*line = lo;
+	*col  = offset -rm->lines[lo];
 }
 
-int preg_checkopt(Preg* rm)
+size_t preg_grepline(const Preg* rm, int nmatch)
 {
-	if (rm->min < 0)
-		return PREG_BADMIN;
-	else if (rm->limit < -1)
-		return PREG_BADLIMIT;
-	else
-		return 0;
+	size_t line;
+	size_t col;
+
+	preg_linecol(rm, preg_start(rm, nmatch, 0), &line, &col);
+
+	return line;
 }
 
-Preg_err_end preg_err_end(int err)
+inline const char* preg_errmsg(const Preg* rm)
 {
-	if (err >= PREG_ERRCODE_START && err < PREG_ERRCODE_END)
-		return internal_errors[ERRCODE_POS(err)].end;
-	else
-		return PREG_EXTERNAL_ERR;
+	return rm->err.errmsg;
 }
 
-/* In case of PREG_INTERDTL_ERR this function should receive an additional
- * argument: a string describing the error details */
-int preg_set_error(Preg* rm, int err, ...)
+inline int preg_errcode(const Preg* rm)
 {
-	Preg_err_end errend;
-
-	errend = preg_err_end(err);
-	switch (errend) {
-		case PREG_INTERNAL_ERR:
-			preg_set_internal_error(rm, err);
-			break;
-		case PREG_EXTERNAL_ERR:
-			err = preg_set_external_error(rm, err);
-			break;
-		case PREG_INTERDTL_ERR:;
-			va_list args;
-			va_start(args, err);
-			err = preg_set_interdtl_error(rm, err, args);
-			va_end(args);
-	}
-	return err;
+	return rm->err.errcode;
 }
 
-void preg_set_internal_error(Preg* rm, int err)
+void preg_stats(const Preg* rm, Preg_stats* stats)
 {
-	rm->err = internal_errors[ERRCODE_POS(err)];
+	*stats = rm->stats;
 }
 
-int preg_set_external_error(Preg* rm, int err)
+/* Resets the counters. The pool gauges describe memory that is still held, so
+ * they are kept */
+void preg_stats_reset(Preg* rm)
 {
-	size_t len;
+	Preg_stats stats = { 0 };
 
-	len = regerror(err, &rm->comp, NULL, 0);
-	rm->err.errmsg = mem_init(rm, len +1);
-	if (!rm->err.errmsg) {
-		preg_set_internal_error(rm, PREG_MEMFAIL);
-		return PREG_MEMFAIL;
-	}
-	regerror(err, &rm->comp, rm->err.errmsg, len);
-	rm->err.errcode = err;
-	rm->err.end = PREG_EXTERNAL_ERR;
+	stats.pool_retained = rm->stats.pool_retained;
+	stats.pool_blocks   = rm->stats.pool_blocks;
+	stats.peak_mem      = rm->stats.pool_retained;
 
-	return err;
+	rm->stats = stats;
 }
 
-int preg_set_interdtl_error(Preg* rm, int err, va_list args)
+size_t preg_profilec(const Preg* rm)
 {
-	char* errdet = va_arg(args, char*);  // Error details
-	const char* errmsg = preg_errmsg(rm);
-	size_t errmsg_len;
-	size_t errdet_len;
+	return rm->profiles.n;
+}
+
+/* Returns the "n"th profile of PREG_PROFILE, in the order the patterns were
+ * first compiled, or NULL if there is no such profile */
+const Preg_profile* preg_profile(const Preg* rm, size_t n)
+{
+	return n < rm->profiles.n ? rm->profiles.entry[n] : NULL;
+}
+
+// Empties the histograms of the profiles, while keeping the profiles
+void preg_profile_reset(Preg* rm)
+{
+	Preg_profile* pf;
+	size_t i;
+
+	for (i = 0; i < rm->profiles.n; ++i) {
+		pf = rm->profiles.entry[i];
+		memset(&pf->compile_ns, 0, sizeof(Preg_histogram));
+		memset(&pf->exec_ns, 0, sizeof(Preg_histogram));
+		memset(&pf->bytes, 0, sizeof(Preg_histogram));
+	}
+}
+
+/* Returns the profiles of PREG_PROFILE as text or as a JSON array, allocated
+ * by the default allocator, or NULL in case of memory allocation failure */
+char* preg_profile_dump(const Preg* rm, Preg_format format)
+{
+	char* res;
+	size_t len;
+
+	len = profile_print(NULL, 0, rm, format);
+	res = preg_malloc(&default_allocator, len +1);
+	if (!res)
+		return NULL;
+	profile_print(res, len +1, rm, format);
+
+	return res;
+}
+
+/* Appends to the "size" bytes of "res", at "*len", like snprintf(). With a
+ * NULL "res" it only counts. "*len" grows by the length of the output */
+static void print_out(char* res, size_t size, size_t* len, const char* fmt,
+                      ...)
+{
+	va_list args;
+	int n;
+
+	if (res && *len >= size)
+		res = NULL;
+
+	va_start(args, fmt);
+	n = vsnprintf(res ? &res[*len] : NULL, res ? size -*len : 0, fmt, args);
+	va_end(args);
+
+	if (n > 0)
+		*len += n;
+}
+
+static void hist_print(char* res, size_t size, size_t* len,
+                       const char* name, const Preg_histogram* h,
+                       Preg_format format)
+{
+	unsigned long long lo;
+	int first = 1;
+	int n;
+
+	if (format == PREG_JSON)
+		print_out(res, size, len, ",\"%s\":{\"count\":%zu,\"sum\":%llu,"
+		          "\"max\":%llu,\"buckets\":[", name, h->count, h->sum, h->max);
+	else
+		print_out(res, size, len, "  %s: count %zu, mean %llu, max %llu\n",
+		          name, h->count, h->count ? h->sum / h->count : 0, h->max);
+
+	// Only the buckets that are not empty, by their lower bound
+	for (n = 0; n < PREG_HIST_BUCKETS; ++n) {
+		if (!h->bucket[n])
+			continue;
+		lo = n ? 1ULL << (n -1) : 0;
+		if (format == PREG_JSON)
+			print_out(res, size, len, "%s[%llu,%zu]", first ? "" : ",", lo,
+			          h->bucket[n]);
+		else
+			print_out(res, size, len, "    >= %llu: %zu\n", lo, h->bucket[n]);
+		first = 0;
+	}
+
+	if (format == PREG_JSON)
+		print_out(res, size, len, "]}");
+}
+
+/* Prints the profiles of "rm" to the "size" bytes of "res" and returns the
+ * length of the output. With a NULL "res" it only measures it */
+static size_t profile_print(char* res, size_t size, const Preg* rm,
+                            Preg_format format)
+{
+	const Preg_profile* pf;
+	const unsigned char* c;
+	size_t len = 0;
+	size_t i;
+
+	if (res)
+		*res = '\0';
+
+	if (format == PREG_JSON)
+		print_out(res, size, &len, "[");
+
+	for (i = 0; i < rm->profiles.n; ++i) {
+		pf = rm->profiles.entry[i];
+
+		if (format == PREG_JSON) {
+			print_out(res, size, &len, "%s{\"pattern\":\"", i ? "," : "");
+			for (c = (const unsigned char*)pf->pattern; *c; ++c) {
+				if (*c == '"' || *c == '\\')
+					print_out(res, size, &len, "\\%c", *c);
+				else if (*c < 0x20)
+					print_out(res, size, &len, "\\u%04x", *c);
+				else
+					print_out(res, size, &len, "%c", *c);
+			}
+			print_out(res, size, &len, "\",\"cflags\":%d", pf->cflags);
+		}
+		else
+			print_out(res, size, &len, "%s (cflags %d)\n", pf->pattern,
+			          pf->cflags);
+
+		hist_print(res, size, &len, "compile_ns", &pf->compile_ns, format);
+		hist_print(res, size, &len, "exec_ns", &pf->exec_ns, format);
+		hist_print(res, size, &len, "bytes", &pf->bytes, format);
+
+		if (format == PREG_JSON)
+			print_out(res, size, &len, "}");
+	}
+
+	if (format == PREG_JSON)
+		print_out(res, size, &len, "]\n");
+
+	return len;
+}
+
+static uint64_t preg_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	// Nanoseconds overflow a 32-bit size_t within seconds
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Starts the time budget of PREG_TIMEOUT for the operation that is called
+static void timeout_start(Preg* rm)
+{
+	rm->deadline = rm->timeout ? preg_clock() +rm->timeout : 0;
+}
+
+/* Wrappers of regcomp() and regexec() that keep the statistics when
+ * PREG_STATS is set, and the profile of the pattern when PREG_PROFILE is set.
+ * preg_comp() also discards any previously compiled pattern, as the handle may
+ * be reused, unless it is the same pattern. Patterns loaded by preg_preload()
+ * are used as they are */
+static int preg_comp(Preg* rm, const char* pattern, int cflags)
+{
+	Preload* pl;
+	uint64_t start = 0;
+	uint64_t ns = 0;
+	size_t len = strlen(pattern);
+	int err;
+
+	if (rm->re && rm->comp_cflags == cflags &&
+	    !strcmp(rm->pat_sc.mem, pattern))
+		return profile_use(rm);
+
+	rm->re    = NULL;
+	rm->prof  = NULL;
+	rm->fixed = FIXED_NONE;
+
+	if (!scratch_get(rm, &rm->pat_sc, len +1))
+		return PREG_MEMFAIL;
+	memcpy(rm->pat_sc.mem, pattern, len +1);
+	rm->comp_cflags = cflags;
+
+	pl = preload_find(rm, pattern, cflags);
+	if (pl) {
+		if (pl->err)
+			return pl->err;
+
+		rm->re   = &pl->comp;
+		rm->subc = pl->comp.re_nsub;
+		rm->info = pl->info;
+		return profile_use(rm);
+	}
+
+	if (rm->compd) {
+		regfree(&rm->comp);
+		rm->compd = 0;
+	}
+
+	if (rm->uflags & (PREG_STATS | PREG_PROFILE))
+		start = preg_clock();
+
+	err = regcomp(&rm->comp, pattern, cflags);
+
+	if (rm->uflags & (PREG_STATS | PREG_PROFILE))
+		ns = preg_clock() -start;
+	if (rm->uflags & PREG_STATS) {
+		rm->stats.compile_ns += ns;
+		rm->stats.compiles++;
+	}
+
+	if (err)
+		return err;
+
+	rm->compd = 1;
+	rm->re    = &rm->comp;
+	rm->subc  = rm->comp.re_nsub;
+	analyze_pattern(pattern, cflags, &rm->info);
+
+	if ((err = profile_use(rm)))
+		return err;
+	if (rm->prof)
+		hist_add(&rm->prof->compile_ns, ns);
+
+	return 0;
+}
+
+static int preg_exec(Preg* rm, const char* subject, regmatch_t* match,
+                     int eflags)
+{
+	return preg_exec_re(rm, rm->re, rm->prof, rm->execn, subject, match,
+	                    eflags);
+}
+
+static int preg_exec_re(Preg* rm, const regex_t* re, Preg_profile* prof,
+                        size_t nmatch, const char* subject, regmatch_t* match,
+                        int eflags)
+{
+	uint64_t start;
+	uint64_t ns;
+	size_t so = 0;
+	size_t eo = 0;
+	int bounded = 0;
+	int err;
+
+	// A search cannot be interrupted, so the budget of PREG_TIMEOUT is
+	// checked before every search of an operation
+	if (rm->deadline && preg_clock() >= rm->deadline)
+		return PREG_TIMEDOUT;
+
+	if (!(rm->uflags & (PREG_STATS | PREG_PROFILE))) {
+		err = regexec(re, subject, nmatch, match, eflags);
+		if (!err)
+			sub_check(match, nmatch);
+		return err;
+	}
+
+#ifdef REG_STARTEND
+	if (eflags & REG_STARTEND) {
+		so = match->rm_so;
+		eo = match->rm_eo;
+		bounded = 1;
+	}
+#endif
+
+	start = preg_clock();
+	err = regexec(re, subject, nmatch, match, eflags);
+	ns = preg_clock() -start;
+
+	if (!err)
+		sub_check(match, nmatch);
+
+	if (rm->uflags & PREG_STATS) {
+		rm->stats.exec_ns += ns;
+		rm->stats.execs++;
+	}
+
+	if (rm->uflags & PREG_PROFILE && prof) {
+		// A search that fails reads the whole subject. Unless the subject
+		// is bounded by REG_STARTEND, its length is needed for counting it
+		if (!err)
+			eo = match->rm_eo;
+		else if (!bounded)
+			eo = strlen(subject);
+		hist_add(&prof->exec_ns, ns);
+		hist_add(&prof->bytes, eo -so);
+	}
+
+	return err;
+}
+
+/* glibc may report a subexpression of a pattern with backreferences that
+ * ends before it starts, such as (1, 0) for \(a*\)*\1b on "aab". Such a
+ * subexpression is taken as not participating in the match */
+static void sub_check(regmatch_t* match, size_t nmatch)
+{
+	size_t j;
+
+	for (j = 1; j < nmatch; ++j)
+		if (match[j].rm_eo < match[j].rm_so)
+			match[j].rm_so = match[j].rm_eo = -1;
+}
+
+/* Returns the profile of "pattern" compiled with "cflags", adding it to the
+ * registry of the handle if it is the first time it is seen. The registry is
+ * looked up like the patterns of preg_preload() */
+static Preg_profile* profile_get(Preg* rm, const char* pattern, int cflags)
+{
+	Preg_profile** table;
+	Preg_profile* pf;
+	size_t len = strlen(pattern);
+	size_t size;
+	size_t i, j;
+
+	if (rm->prof_size) {
+		i = preload_hash(pattern, cflags) & (rm->prof_size -1);
+		while ((pf = rm->prof_table[i])) {
+			if (pf->cflags == cflags && !strcmp(pf->pattern, pattern))
+				return pf;
+			i = (i +1) & (rm->prof_size -1);
+		}
+	}
+
+	// Keep the table at most half full
+	if (2 * (rm->profiles.n +1) > rm->prof_size) {
+		size = rm->prof_size ? 2 * rm->prof_size : 16;
+		table = preg_malloc(&rm->alloc, size * sizeof(Preg_profile*));
+		if (!table)
+			return NULL;
+		for (i = 0; i < size; ++i)
+			table[i] = NULL;
+
+		for (i = 0; i < rm->profiles.n; ++i) {
+			pf = rm->profiles.entry[i];
+			j = preload_hash(pf->pattern, pf->cflags) & (size -1);
+			while (table[j])
+				j = (j +1) & (size -1);
+			table[j] = pf;
+		}
+
+		preg_mfree(&rm->alloc, rm->prof_table);
+		rm->prof_table = table;
+		rm->prof_size  = size;
+	}
+
+	pf = preg_malloc(&rm->alloc, sizeof(Preg_profile) +len +1);
+	if (!pf)
+		return NULL;
+	if (pvoid_vec_append(&rm->profiles, pf)) {
+		preg_mfree(&rm->alloc, pf);
+		return NULL;
+	}
+
+	memset(pf, 0, sizeof(Preg_profile));
+	memcpy(pf +1, pattern, len +1);
+	pf->pattern = (char*)(pf +1);
+	pf->cflags  = cflags;
+
+	i = preload_hash(pattern, cflags) & (rm->prof_size -1);
+	while (rm->prof_table[i])
+		i = (i +1) & (rm->prof_size -1);
+	rm->prof_table[i] = pf;
+
+	return pf;
+}
+
+// Points "rm->prof" to the profile of the pattern in use, if it has none
+static int profile_use(Preg* rm)
+{
+	if (!(rm->uflags & PREG_PROFILE) || rm->prof)
+		return 0;
+
+	rm->prof = profile_get(rm, rm->pat_sc.mem, rm->comp_cflags);
+
+	return rm->prof ? 0 : PREG_MEMFAIL;
+}
+
+static void hist_add(Preg_histogram* h, unsigned long long val)
+{
+	unsigned long long max;
+	int n = 0;
+
+	// The bucket is the number of significant bits of "val"
+	while (n < PREG_HIST_BUCKETS -1 && val >> n)
+		++n;
+
+	ATOMIC_ADD(&h->count, 1);
+	ATOMIC_ADD(&h->sum, val);
+	ATOMIC_ADD(&h->bucket[n], 1);
+
+	max = ATOMIC_LOAD(&h->max);
+	while (val > max && !ATOMIC_CAS(&h->max, &max, val))
+		;
+}
+
+/* Compiles a set of patterns ahead of the operations that use them. A handle
+ * keeps them until it is freed, and preg_comp() picks them up when an
+ * operation is given one of them with the same flags. With PREG_THREADS the
+ * patterns are compiled in parallel */
+int preg_preload(Preg* rm, Preg_pattern* pats, size_t n)
+{
+	Preload** added;
+	Preload* pl;
+	Preload_job job[MAX_THREADS];
+	size_t addedc = 0;
+	uint64_t start = 0;
+	size_t threads;
+	size_t i;
+	int err = 0;
+
+	if (!n)
+		return preg_set_error(rm, 0);
+
+	added = preg_malloc(&rm->alloc, n * sizeof(Preload*));
+	if (!added || preload_grow(rm, rm->preloadc +n)) {
+		preg_mfree(&rm->alloc, added);
+		return preg_set_error(rm, PREG_MEMFAIL);
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (preload_find(rm, pats[i].pattern, pats[i].cflags))
+			continue;
+		if (!(added[addedc] = preload_add(rm, &pats[i])))
+			break;
+		++addedc;
+	}
+
+	// The patterns are profiled from their compilation on
+	if (rm->uflags & PREG_PROFILE)
+		for (i = 0; i < addedc; ++i) {
+			added[i]->prof = profile_get(rm, added[i]->pattern,
+			                             added[i]->cflags);
+			if (!added[i]->prof)
+				err = PREG_MEMFAIL;
+		}
+
+	if (rm->uflags & PREG_STATS)
+		start = preg_clock();
+
+	threads = rm->threads > 1 ? rm->threads : 1;
+	if (threads > addedc)
+		threads = addedc ? addedc : 1;
+
+	for (i = 0; i < threads; ++i) {
+		job[i].pl     = &added[i];
+		job[i].n      = addedc -i;
+		job[i].stride = threads;
+	}
+
+#ifdef HAVE_PTHREAD
+	{
+		pthread_t tid[MAX_THREADS];
+		int started[MAX_THREADS];
+
+		for (i = 1; i < threads; ++i) {
+			started[i] = !pthread_create(&tid[i], NULL, preload_comp, &job[i]);
+			if (!started[i])
+				preload_comp(&job[i]);
+		}
+
+		preload_comp(&job[0]);
+
+		for (i = 1; i < threads; ++i)
+			if (started[i])
+				pthread_join(tid[i], NULL);
+	}
+#else
+	for (i = 0; i < threads; ++i)
+		preload_comp(&job[i]);
+#endif
+
+	if (rm->uflags & PREG_STATS) {
+		rm->stats.compile_ns += preg_clock() -start;
+		rm->stats.compiles   += addedc;
+	}
+
+	preg_mfree(&rm->alloc, added);
+
+	// Patterns that did not fit are reported as such
+	for (i = 0; i < n; ++i) {
+		pl = preload_find(rm, pats[i].pattern, pats[i].cflags);
+		pats[i].err = pl ? pl->err : PREG_MEMFAIL;
+		if (!err)
+			err = pats[i].err;
+	}
+
+	return preg_set_error(rm, err);
+}
+
+static void* preload_comp(void* arg)
+{
+	Preload_job* job = arg;
+	Preload* pl;
+	uint64_t start = 0;
+	size_t i;
+
+	for (i = 0; i < job->n; i += job->stride) {
+		pl = job->pl[i];
+		if (pl->prof)
+			start = preg_clock();
+		pl->err = regcomp(&pl->comp, pl->pattern, pl->cflags);
+		if (pl->prof)
+			hist_add(&pl->prof->compile_ns, preg_clock() -start);
+		if (!pl->err)
+			analyze_pattern(pl->pattern, pl->cflags, &pl->info);
+	}
+
+	return NULL;
+}
+
+// FNV-1a hash of the pattern, mixed with the flags
+static size_t preload_hash(const char* pattern, int cflags)
+{
+	size_t h = 2166136261u;
+
+	for (; *pattern; ++pattern) {
+		h ^= (unsigned char)*pattern;
+		h *= 16777619u;
+	}
+	h ^= cflags;
+	h *= 16777619u;
+
+	return h;
+}
+
+static Preload* preload_find(const Preg* rm, const char* pattern, int cflags)
+{
+	Preload* pl;
+	size_t i;
+
+	if (!rm->preloadc)
+		return NULL;
+
+	i = preload_hash(pattern, cflags) & (rm->preload_size -1);
+	while ((pl = rm->preload[i])) {
+		if (pl->cflags == cflags && !strcmp(pl->pattern, pattern))
+			return pl;
+		i = (i +1) & (rm->preload_size -1);
+	}
+
+	return NULL;
+}
+
+/* Inserts an uncompiled entry for "pat". The table shall have room for it */
+static Preload* preload_add(Preg* rm, const Preg_pattern* pat)
+{
+	Preload* pl;
+	size_t len = strlen(pat->pattern);
+	size_t i;
+
+	pl = preg_malloc(&rm->alloc, sizeof(Preload) +len +1);
+	if (!pl)
+		return NULL;
+
+	pl->pattern = (char*)(pl +1);
+	memcpy(pl->pattern, pat->pattern, len +1);
+	pl->cflags = pat->cflags;
+	pl->err    = PREG_MEMFAIL;
+	pl->prof   = NULL;
+
+	i = preload_hash(pl->pattern, pl->cflags) & (rm->preload_size -1);
+	while (rm->preload[i])
+		i = (i +1) & (rm->preload_size -1);
+	rm->preload[i] = pl;
+	rm->preloadc++;
+
+	return pl;
+}
+
+/* Makes room for "n" entries, keeping the table at most half full */
+static int preload_grow(Preg* rm, size_t n)
+{
+	Preload** table;
+	size_t size = rm->preload_size ? rm->preload_size : 16;
+	size_t i, j;
+
+	while (size < 2 * n)
+		size *= 2;
+	if (size == rm->preload_size)
+		return 0;
+
+	table = preg_malloc(&rm->alloc, size * sizeof(Preload*));
+	if (!table)
+		return PREG_MEMFAIL;
+	for (i = 0; i < size; ++i)
+		table[i] = NULL;
+
+	for (i = 0; i < rm->preload_size; ++i) {
+		if (!rm->preload[i])
+			continue;
+		j = preload_hash(rm->preload[i]->pattern, rm->preload[i]->cflags);
+		j &= size -1;
+		while (table[j])
+			j = (j +1) & (size -1);
+		table[j] = rm->preload[i];
+	}
+
+	preg_mfree(&rm->alloc, rm->preload);
+	rm->preload      = table;
+	rm->preload_size = size;
+
+	return 0;
+}
+
+Preg* preg_init(void)
+{
+	return preg_init_ex(NULL);
+}
+
+/* Initializes a handle whose memory is served by "alloc". A NULL "alloc"
+ * stands for the default allocator */
+Preg* preg_init_ex(const Preg_allocator* alloc)
+{
+	Preg* rm;
+
+	if (!alloc)
+		alloc = &default_allocator;
+
+	rm = preg_malloc(alloc, sizeof(Preg));
+	if (rm) {
+		memset(rm, 0, sizeof(Preg));
+		// NULL may not be represented as zeroed memory
+		rm->offset = NULL;
+		rm->offset_base = NULL;
+		rm->re     = NULL;
+		rm->preload = NULL;
+		rm->prof   = NULL;
+		rm->prof_table = NULL;
+		rm->cflags = REG_EXTENDED;
+		rm->limit  = -1;
+		rm->err	   = internal_errors[ERRCODE_POS(PREG_NOACTION)];
+		rm->mode   = -1;
+		rm->alloc  = *alloc;
+		rm->results.extra = pvoid_vec_init_auto(&rm->alloc);
+		rm->bref   = bref_vec_init_auto(&rm->alloc);
+		rm->rules  = pvoid_vec_init_auto(&rm->alloc);
+		rm->profiles = pvoid_vec_init_auto(&rm->alloc);
+		rm->mpools = pvoid_vec_init(&rm->alloc);
+		if (!rm->mpools) {
+			preg_mfree(alloc, rm);
+			return NULL;
+		}
+	}
+
+	return rm;
+}
+
+void preg_free(Preg* rm)
+{
+	Preg_allocator alloc;
+	int i;
+
+	if (rm) {
+		if (rm->compd)
+			regfree(&rm->comp);
+
+		for (i = 0; i < rm->preload_size; ++i) {
+			if (!rm->preload[i])
+				continue;
+			if (!rm->preload[i]->err)
+				regfree(&rm->preload[i]->comp);
+			preg_mfree(&rm->alloc, rm->preload[i]);
+		}
+		preg_mfree(&rm->alloc, rm->preload);
+
+		for (i = 0; i < rm->profiles.n; ++i)
+			preg_mfree(&rm->alloc, rm->profiles.entry[i]);
+		pvoid_vec_free_auto(&rm->profiles, NULL);
+		preg_mfree(&rm->alloc, rm->prof_table);
+
+		for (i = 0; i < rm->mpools->n; ++i)
+			preg_mfree(&rm->alloc, rm->mpools->entry[i]);
+		pvoid_vec_free(rm->mpools, NULL);
+
+		for (i = 0; i < rm->results.extra.n; ++i)
+			preg_mfree(&rm->alloc, rm->results.extra.entry[i]);
+		pvoid_vec_free_auto(&rm->results.extra, NULL);
+		preg_mfree(&rm->alloc, rm->results.mem);
+
+		preg_mfree(&rm->alloc, rm->match_sc.mem);
+		preg_mfree(&rm->alloc, rm->lit_sc.mem);
+		preg_mfree(&rm->alloc, rm->found_sc.mem);
+		preg_mfree(&rm->alloc, rm->rep_sc.mem);
+		preg_mfree(&rm->alloc, rm->pat_sc.mem);
+		preg_mfree(&rm->alloc, rm->out_sc.mem);
+		preg_mfree(&rm->alloc, rm->fields_sc.mem);
+		preg_mfree(&rm->alloc, rm->recs_sc.mem);
+		preg_mfree(&rm->alloc, rm->pack_sc.mem);
+		preg_mfree(&rm->alloc, rm->blocks_sc.mem);
+		preg_mfree(&rm->alloc, rm->pend_sc.mem);
+		bref_vec_free_auto(&rm->bref, NULL);
+		preg_clearrules(rm);
+		pvoid_vec_free_auto(&rm->rules, NULL);
+
+		preg_mfree(&rm->alloc, rm->offset);
+		preg_mfree(&rm->alloc, rm->offset_base);
+		preg_mfree(&rm->alloc, rm->lines);
+
+		alloc = rm->alloc;
+		preg_mfree(&alloc, rm);
+	}
+}
+
+/* Brings "rm" back to the state preg_init() leaves it in, while keeping the
+ * memory it has grown, the pattern it has compiled last and the patterns of
+ * preg_preload(), which only spare the next user their compilation. The
+ * profiles of PREG_PROFILE are kept too, but emptied */
+static void handle_reset(Preg* rm)
+{
+	Preg_cursor none = { 0 };
+
+	rm->cflags  = REG_EXTENDED;
+	rm->uflags  = 0;
+	rm->min     = 0;
+	rm->limit   = -1;
+	rm->maxmem  = 0;
+	rm->threads = 0;
+	rm->submask = 0;
+	rm->timeout = 0;
+	rm->step.bytes   = 0;
+	rm->step.execs   = 0;
+	rm->step.subject = NULL;
+	rm->from   = none;
+	rm->next   = none;
+	rm->resume = 0;
+	rm->start  = 0;
+	rm->matc   = 0;
+	rm->linec  = 0;
+	rm->err    = internal_errors[ERRCODE_POS(PREG_NOACTION)];
+	rm->mode   = -1;
+	preg_clearrules(rm);
+	mem_reset(rm);
+	preg_stats_reset(rm);
+	preg_profile_reset(rm);
+}
+
+/* Creates a pool that keeps up to "max" idle handles for reuse. The handles
+ * are served by "alloc", or the default allocator if it is NULL */
+Preg_pool* preg_pool_init(size_t max, const Preg_allocator* alloc)
+{
+	Preg_pool* pool;
+	Pool_shard* sh;
+	size_t i;
+
+	if (!alloc)
+		alloc = &default_allocator;
+
+	pool = preg_malloc(alloc, sizeof(Preg_pool));
+	if (!pool)
+		return NULL;
+
+	pool->alloc = *alloc;
+	pool->max   = max;
+	pool->idle  = 0;
+
+	for (i = 0; i < POOL_SHARDS; ++i) {
+		sh = &pool->shard[i];
+		sh->n = 0;
+		sh->idle = NULL;
+
+		// Any shard may hold all of the idle handles
+		if (pool->max) {
+			sh->idle = preg_malloc(alloc, pool->max * sizeof(Preg*));
+			if (!sh->idle) {
+				pool_destroy(pool, i);
+				return NULL;
+			}
+		}
+#ifdef HAVE_PTHREAD
+		if (pthread_mutex_init(&sh->lock, NULL)) {
+			preg_mfree(alloc, sh->idle);
+			pool_destroy(pool, i);
+			return NULL;
+		}
+#endif
+	}
+
+	return pool;
+}
+
+/* Takes an idle handle from "pool", or initializes a new one if there is
+ * none. Returns NULL on memory allocation failure */
+Preg* preg_pool_get(Preg_pool* pool)
+{
+	Pool_shard* home = pool_shard(pool);
+	Pool_shard* sh;
+	Preg* rm = NULL;
+	size_t i;
+
+	// The other shards are searched only before initializing a new handle
+	for (i = 0; i < POOL_SHARDS && !rm; ++i) {
+		sh = &pool->shard[(home -pool->shard +i) % POOL_SHARDS];
+
+		SHARD_LOCK(sh);
+		if (sh->n)
+			rm = sh->idle[--sh->n];
+		SHARD_UNLOCK(sh);
+	}
+
+	if (rm)
+		ATOMIC_SUB(&pool->idle, 1);
+
+	return rm ? rm : preg_init_ex(&pool->alloc);
+}
+
+/* Resets "rm", a handle of preg_pool_get(), and makes it idle in "pool". It
+ * is freed instead if the pool already keeps "max" idle handles */
+void preg_pool_put(Preg_pool* pool, Preg* rm)
+{
+	Pool_shard* sh;
+	size_t idle;
+
+	if (!rm)
+		return;
+
+	// A place among the idle handles of the whole pool is taken first
+	idle = ATOMIC_LOAD(&pool->idle);
+	while (idle < pool->max && !ATOMIC_CAS(&pool->idle, &idle, idle +1))
+		;
+	if (idle >= pool->max) {
+		preg_free(rm);
+		return;
+	}
+
+	handle_reset(rm);
+
+	// The shard cannot be full, unless the count is not atomic
+	sh = pool_shard(pool);
+	SHARD_LOCK(sh);
+	if (sh->n < pool->max) {
+		sh->idle[sh->n++] = rm;
+		rm = NULL;
+	}
+	SHARD_UNLOCK(sh);
+
+	if (rm) {
+		ATOMIC_SUB(&pool->idle, 1);
+		preg_free(rm);
+	}
+}
+
+// Frees "pool" and its idle handles
+void preg_pool_free(Preg_pool* pool)
+{
+	if (pool)
+		pool_destroy(pool, POOL_SHARDS);
+}
+
+// Returns the shard of the calling thread
+static Pool_shard* pool_shard(Preg_pool* pool)
+{
+#ifdef HAVE_PTHREAD
+	pthread_t self = pthread_self();
+	uint64_t h = 0;
+	uint64_t v;
+	size_t n;
+	size_t i;
+
+	// pthread_t is opaque, so its bytes are hashed, and the high bits of a
+	// multiplicative hash depend on all of them
+	for (i = 0; i < sizeof(self); i += n) {
+		n = sizeof(self) -i < sizeof(v) ? sizeof(self) -i : sizeof(v);
+		v = 0;
+		memcpy(&v, (const char*)&self +i, n);
+		h = (h ^ v) * UINT64_C(0x9e3779b97f4a7c15);
+	}
+
+	return &pool->shard[h >> (64 -POOL_SHARD_BITS)];
+#else
+	return &pool->shard[0];
+#endif
+}
+
+// Frees the first "shards" shards of "pool", which are initialized, and "pool"
+static void pool_destroy(Preg_pool* pool, size_t shards)
+{
+	Preg_allocator alloc = pool->alloc;
+	Pool_shard* sh;
+	size_t i;
+
+	for (i = 0; i < shards; ++i) {
+		sh = &pool->shard[i];
+		while (sh->n)
+			preg_free(sh->idle[--sh->n]);
+		preg_mfree(&alloc, sh->idle);
+#ifdef HAVE_PTHREAD
+		pthread_mutex_destroy(&sh->lock);
+#endif
+	}
+
+	preg_mfree(&alloc, pool);
+}
+
+void preg_set_mode(Preg* rm, Preg_mode mode)
+{
+	rm->mode = mode;
+	switch (rm->mode) {
+	case PREG_MATCH:
+		rm->matches.match = NULL;
+		rm->matches.cap   = 0;
+		rm->matches.dead  = 0;
+		break;
+	case PREG_REPLACE:
+		rm->rep.str = NULL;
+		rm->rep.len = 0;
+		break;
+	case PREG_SPLIT:
+		rm->splits.split = NULL;
+		rm->splits.size = 0;
+		break;
+	case PREG_GREP:
+		// The results are kept in the offset matrix and the line index
+		break;
+	case PREG_COLUMNS:
+		memset(&rm->cols, 0, sizeof(rm->cols));
+		break;
+	}
+}
+
+void preg_setopt(Preg* rm, Preg_opt opt, int value)
+{
+	switch (opt) {
+	case PREG_CFLAGS:
+		rm->cflags |= value;
+		break;
+	case PREG_UFLAGS:
+		rm->uflags |= value;
+		break;
+	case PREG_MIN:
+		rm->min = value;
+		break;
+	case PREG_LIMIT:
+		rm->limit = value;
+		break;
+	case PREG_MAXMEM:
+		rm->maxmem = value > 0 ? value : 0;
+		break;
+	case PREG_STEPBYTES:
+		rm->step.bytes = value > 0 ? value : 0;
+		rm->step.subject = NULL;
+		break;
+	case PREG_STEPEXECS:
+		rm->step.execs = value > 0 ? value : 0;
+		rm->step.subject = NULL;
+		break;
+	case PREG_THREADS:
+		rm->threads = value < 0 ? 0 : value > MAX_THREADS ? MAX_THREADS : value;
+		break;
+	case PREG_SUBMASK:
+		rm->submask = value;
+		break;
+	case PREG_TIMEOUT:
+		rm->timeout = value > 0 ? (uint64_t)value * 1000000 : 0;
+	}
+}
+
+void preg_delopt(Preg* rm, Preg_opt opt, int value)
+{
+	switch (opt) {
+	case PREG_CFLAGS:
+		rm->cflags &= ~value;
+		break;
+	case PREG_UFLAGS:
+		rm->uflags &= ~value;
+		break;
+	case PREG_MAXMEM:
+		rm->maxmem = 0;
+		break;
+	case PREG_STEPBYTES:
+		rm->step.bytes = 0;
+		rm->step.subject = NULL;
+		break;
+	case PREG_STEPEXECS:
+		rm->step.execs = 0;
+		rm->step.subject = NULL;
+		break;
+	case PREG_THREADS:
+		rm->threads = 0;
+		break;
+	case PREG_SUBMASK:
+		rm->submask = 0;
+		break;
+	case PREG_TIMEOUT:
+		rm->timeout = 0;
+	default:
+		break;
+	}
+}
+
+int preg_checkopt(Preg* rm)
+{
+	if (rm->min < 0)
+		return PREG_BADMIN;
+	else if (rm->limit < -1)
+		return PREG_BADLIMIT;
+	else
+		return 0;
+}
+
+Preg_err_end preg_err_end(int err)
+{
+	if (err >= PREG_ERRCODE_START && err < PREG_ERRCODE_END)
+		return internal_errors[ERRCODE_POS(err)].end;
+	else
+		return PREG_EXTERNAL_ERR;
+}
+
+/* In case of PREG_INTERDTL_ERR this function should receive an additional
+ * argument: a string describing the error details */
+int preg_set_error(Preg* rm, int err, ...)
+{
+	Preg_err_end errend;
+
+	errend = preg_err_end(err);
+	switch (errend) {
+		case PREG_INTERNAL_ERR:
+			preg_set_internal_error(rm, err);
+			break;
+		case PREG_EXTERNAL_ERR:
+			err = preg_set_external_error(rm, err);
+			break;
+		case PREG_INTERDTL_ERR:;
+			va_list args;
+			va_start(args, err);
+			err = preg_set_interdtl_error(rm, err, args);
+			va_end(args);
+	}
+	return err;
+}
+
+void preg_set_internal_error(Preg* rm, int err)
+{
+	rm->err = internal_errors[ERRCODE_POS(err)];
+}
+
+int preg_set_external_error(Preg* rm, int err)
+{
+	size_t len;
+
+	len = regerror(err, &rm->comp, NULL, 0);
+	rm->err.errmsg = mem_init(rm, len +1);
+	if (!rm->err.errmsg) {
+		preg_set_internal_error(rm, PREG_MEMFAIL);
+		return PREG_MEMFAIL;
+	}
+	regerror(err, &rm->comp, rm->err.errmsg, len);
+	rm->err.errcode = err;
+	rm->err.end = PREG_EXTERNAL_ERR;
+
+	return err;
+}
+
+int preg_set_interdtl_error(Preg* rm, int err, va_list args)
+{
+	char* errdet = va_arg(args, char*);  // Error details
+	const char* errmsg;
+	size_t errmsg_len;
+	size_t errdet_len;
+
+	rm->err = internal_errors[ERRCODE_POS(err)];
+	errmsg = preg_errmsg(rm);
+
+	errmsg_len = strlen(errmsg);
+	errdet_len = strlen(errdet);
+
+	rm->err.errmsg = mem_init(rm, errmsg_len +errdet_len +3);
+	if (!rm->err.errmsg) {
+		preg_set_internal_error(rm, PREG_MEMFAIL);
+		return PREG_MEMFAIL;
+	}
+	memcpy(rm->err.errmsg, errmsg, errmsg_len);
+	memcpy(&rm->err.errmsg[errmsg_len], ": ", 2);
+	memcpy(&rm->err.errmsg[errmsg_len +2], errdet, errdet_len +1);
+
+	return err;
+}
+
+/* If len == -1 preg_escape expects a null terminated string. Else the first len
+ * bytes will be escaped */
+char* preg_escape(const char* str, Preg_notation notation, size_t len)
+{
+	const char* special_char;
+	char* res;
+
+	switch (notation) {
+		case PREG_BRE:
+			special_char = bre_specials;
+			break;
+		case PREG_ERE:
+			special_char = ere_specials;
+	}
+
+	if (len == -1)
+		len = strlen(str);
+
+	res = preg_malloc(&default_allocator, escape(NULL, str, len, special_char) +1);
+	if (!res)
+		return NULL;
+
+	escape(res, str, len, special_char);
+
+	return res;
+}
+
+/* Writes "str" with a backslash before every character of "specials" to "res"
+ * and null-terminates it, unless "res" is NULL. Returns the escaped length */
+static size_t escape(char* res, const char* str, size_t len,
+                     const char* specials)
+{
+	size_t index = 0;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		if (strchr(specials, str[i])) {
+			if (res)
+				res[index] = '\\';
+			++index;
+		}
+		if (res)
+			res[index] = str[i];
+		++index;
+	}
+	if (res)
+		res[index] = '\0';
+
+	return index;
+}
+
+/* Performs a regex match on a given string and stores the results in the
+ * "offset" array inside "rm".
+ *
+ * Parameters:
+ * Preg* rm:			An initialized Preg structure
+ * const char* subject: The string on which the regex search is performed
+ * const char* pattern:	The regex pattern
+ * int submask:			The subexpressions to keep as with PREG_SUBMASK, 0
+ *						keeping all of them
+ *
+ * On success it returns 0. Else it returns an error code.
+ */
+int preg_offset(Preg* rm, const char* subject, const char* pattern,
+                int submask)
+{
+	Preg_cursor from = { 0 };
+	regmatch_t* match = NULL;
+	Fixed fx;
+	size_t subject_ro = 0;      // Running offset
+	size_t begin;               // Where this call started searching
+	size_t execs = 0;           // Searches performed by this call
+	size_t len;
+	int eflags = 0;
+	int adjacent;
+	int resumed;
+	int literal = rm->uflags & PREG_LITERAL;
+	int err = 0;
+	size_t i;
+
+	timeout_start(rm);
+
+	// Remove REG_NOSUB
+	if (REG_NOSUB&rm->cflags)
+		rm->cflags &= ~REG_NOSUB;
+
+	// Literals that can't be searched as they are, are escaped for regcomp()
+	if (literal && (!*pattern || rm->cflags & REG_ICASE)) {
+		pattern = literal_escape(rm, pattern);
+		if (!pattern) {
+			err = PREG_MEMFAIL;
+			goto done;
+		}
+		literal = 0;
+	}
+
+	// Continue a search that ran out of its budget
+	resumed = step_continues(rm, subject, pattern, literal);
+	if (resumed)
+		from = rm->next;
+	else {
+		rm->step.skipped = 0;
+		rm->step.scan = 0;
+
+		// Resume from a cursor of a previous search
+		if (rm->resume) {
+			from = rm->from;
+			rm->resume = 0;
+		}
+		rm->start = from.offset;
+		rm->next  = from;
+	}
+	subject_ro = begin = from.offset;
+	eflags = from.eflags;
+	adjacent = from.adjacent;
+
+	err = preg_checkopt(rm);
+	if (err)
+		goto done;
+
+	// The handle may be reused, so discard any previous results
+	if (!resumed) {
+		rm->matc = 0;
+		rm->packed = !!(rm->uflags & PREG_COMPACT);
+		rm->sel = submask;
+		mem_reset(rm);
+	}
+
+	// The previous page already reached the end of the subject
+	if (from.done) {
+		err = REG_NOMATCH;
+		goto done;
+	}
+
+	len = strlen(subject);
+	rm->wide   = len > REGOFF_MAX;
+	rm->sublen = len;
+	if (rm->wide && (err = offset_widen(rm)))
+		goto done;
+
+	// Patterns such as "," or "[ \t]+" are searched without regcomp()
+	if (literal) {
+		fx.kind = FIXED_LITERAL;
+		fx.str  = pattern;
+		fx.len  = strlen(pattern);
+	}
+	else
+		fx.kind = bclass_compile(&fx.bc, pattern, rm->cflags) ? FIXED_BCLASS
+		                                                      : FIXED_NONE;
+	if (fx.kind) {
+		err = fixed_set(rm, pattern, fx.kind);
+		if (!err) {
+			sub_select(rm);
+			err = preg_offset_fixed(rm, subject, len, &fx);
+		}
+		goto done;
+	}
+
+	err = preg_comp(rm, pattern, rm->cflags);
+	if (err)
+		goto done;
+	sub_select(rm);
+
+	match = scratch_get(rm, &rm->match_sc, (rm->subc +1) * sizeof(*match));
+	if (!match) {
+		err = PREG_MEMFAIL;
+		goto done;
+	}
+
+	// Find and discard matches until reaching the minimum accepted match
+	for (; rm->step.skipped < rm->min; rm->step.skipped++) {
+		if (step_spent(rm, subject_ro -begin, execs)) {
+			err = PREG_INPROGRESS;
+			break;
+		}
+
+		err = offset_exec(rm, subject, len, &subject_ro, match, &eflags,
+		                  &adjacent);
+		execs++;
+		if (err)
+			break;
+
+		offset_advance(subject, &subject_ro, match, &eflags, &adjacent);
+		rm->next.index++;
+	}
+
+	for (i = rm->matc; !err; ++i) {
+		if (step_spent(rm, subject_ro -begin, execs)) {
+			err = PREG_INPROGRESS;
+			break;
+		}
+
+		err = offset_exec(rm, subject, len, &subject_ro, match, &eflags,
+		                  &adjacent);
+		execs++;
+		if (err || i >= (size_t)rm->limit)
+			break;
+
+		if (rm->sel)
+			sub_gather(rm, match);
+		if ((err = offset_store(rm, i, match, subject_ro)))
+			goto done;
+		offset_advance(subject, &subject_ro, match, &eflags, &adjacent);
+		rm->matc++;
+
+		/* Sometimes the empty pattern may successfully match zero characters.
+		 * But there is nothing more to be done so we break */
+		if (*pattern == '\0')
+			break;
+	}
+	rm->next.offset   = subject_ro;
+	rm->next.eflags   = eflags;
+	rm->next.adjacent = adjacent;
+
+	if (rm->uflags & PREG_STATS)
+		rm->stats.bytes_scanned += subject_ro -begin;
+
+	if (err == PREG_INPROGRESS)
+		goto done;
+
+	rm->next.index   += rm->matc;
+	rm->next.done     = err == REG_NOMATCH || *pattern == '\0';
+
+	if (rm->uflags & PREG_STATS) {
+		if (err == REG_NOMATCH)
+			rm->stats.bytes_scanned += len -subject_ro;
+		rm->stats.matches += rm->matc;
+	}
+
+	if (err == REG_NOMATCH && rm->matc > 0)
+		err = 0;
+
+done:
+	// The next call continues from where this one stopped
+	rm->step.subject = err == PREG_INPROGRESS ? subject : NULL;
+	rm->step.mode    = rm->mode;
+
+	return err;
+}
+
+/* Returns 1 if preg_offset() shall continue the search of the previous call,
+ * which ran out of its budget */
+static int step_continues(const Preg* rm, const char* subject,
+                          const char* pattern, int literal)
+{
+	return rm->step.subject == subject && rm->step.mode == rm->mode &&
+	       (rm->re || rm->fixed) && rm->comp_cflags == rm->cflags &&
+	       (rm->fixed == FIXED_LITERAL) == !!literal &&
+	       !strcmp(rm->pat_sc.mem, pattern);
+}
+
+/* Returns 1 if a call that has searched "bytes" bytes with "execs" searches
+ * has used up its budget. Every call performs at least one search so that
+ * it always makes progress */
+static int step_spent(const Preg* rm, size_t bytes, size_t execs)
+{
+	return execs && ((rm->step.execs && execs >= rm->step.execs) ||
+	                 (rm->step.bytes && bytes >= rm->step.bytes));
+}
+
+/* Searches "subject" of length "len" from "*ro" for the next match that can
+ * be accepted. Like sed(1), an empty match where the previous match ended is
+ * not accepted. The properties of the pattern found by analyze_pattern() let
+ * it skip the parts of the subject where no match can start */
+static int offset_exec(Preg* rm, const char* subject, size_t len, size_t* ro,
+                       regmatch_t* match, int* eflags, int* adjacent)
+{
+	const Analysis* an = &rm->info;
+	const char* nl;
+	size_t rest;
+	size_t win;
+	int err;
+
+	for (;;) {
+		// The rest of the subject is shorter than any match
+		if (len -*ro < an->minlen)
+			return REG_NOMATCH;
+
+		if (an->bol && (*eflags & REG_NOTBOL)) {
+			// "^" only matches at the start of the subject
+			if (!(rm->cflags & REG_NEWLINE))
+				return REG_NOMATCH;
+
+			// Or at the start of a line
+			if (*ro && subject[*ro -1] != '\n') {
+				nl = strchr(&subject[*ro], '\n');
+				if (!nl)
+					return REG_NOMATCH;
+				*ro = nl -subject +1;
+				*adjacent = 0;
+			}
+		}
+
+		// regexec() cannot tell that the search starts at a line start
+		if ((rm->cflags & REG_NEWLINE) && *ro && subject[*ro -1] == '\n')
+			*eflags &= ~REG_NOTBOL;
+
+		// A "len" of ANALYZE_UNBOUNDED stays unknown
+		rest = len == ANALYZE_UNBOUNDED ? len : len -*ro;
+
+		err = window_exec(rm, &subject[*ro], rest, match, *eflags, &win);
+		if (err == REG_NOMATCH && win < rest) {
+			// Continue with the window that follows
+			*ro += win;
+			*eflags |= REG_NOTBOL;
+			*adjacent = 0;
+			continue;
+		}
+		if (err || !*adjacent || match->rm_eo > 0)
+			return err;
+
+		if (!subject[*ro])
+			return REG_NOMATCH;
+
+		*ro += char_len(&subject[*ro]);
+		*eflags |= REG_NOTBOL;
+		*adjacent = 0;
+	}
+}
+
+/* Searches "s", the rest of the subject of length "rest", like preg_exec()
+ * does. A "rest" of ANALYZE_UNBOUNDED stands for an unknown length.
+ *
+ * A single regexec() call cannot report offsets past REGOFF_MAX, so a longer
+ * "rest" is searched in windows that end right after a newline. Only matches
+ * that start in the window "win" are reported; REG_NOMATCH with "*win" less
+ * than "rest" means the search continues with the next window. Since a match
+ * shall not span windows, this needs a pattern that cannot match a newline.
+ * Otherwise, or if no newline is found, it returns PREG_TOOLARGE */
+static int window_exec(Preg* rm, const char* s, size_t rest, regmatch_t* match,
+                       int eflags, size_t* win)
+{
+#ifdef REG_STARTEND
+	size_t n;
+	int err;
+#endif
+
+	*win = rest;
+	if (rest == ANALYZE_UNBOUNDED)
+		return preg_exec(rm, s, match, eflags);
+
+#ifdef REG_STARTEND
+	if (rest > REGOFF_MAX) {
+		if (rm->info.newline)
+			return PREG_TOOLARGE;
+
+		for (n = REGOFF_MAX; n > 0 && s[n -1] != '\n'; --n)
+			;
+		if (!n)
+			return PREG_TOOLARGE;
+
+		*win = n;
+		eflags |= REG_NOTEOL;
+	}
+
+	// The bounds also spare regexec() measuring the rest of the subject
+	match->rm_so = 0;
+	match->rm_eo = *win;
+	err = preg_exec(rm, s, match, eflags | REG_STARTEND);
+
+	// A match at the end of the window belongs to the next one
+	if (!err && *win < rest && match->rm_so == *win)
+		err = REG_NOMATCH;
+
+	return err;
+#else
+	if (rest > REGOFF_MAX)
+		return PREG_TOOLARGE;
+
+	return preg_exec(rm, s, match, eflags);
+#endif
+}
+
+/* Stores "match", whose offsets count from "base", to the row "i" of the
+ * offset matrix, or to the packed offsets. Rows of a "wide" subject keep
+ * "base" aside, so that their offsets fit in regoff_t */
+static int offset_store(Preg* rm, size_t i, const regmatch_t* match,
+                        size_t base)
+{
+	size_t j;
+	int err;
+
+	if (rm->packed)
+		return pack_add(rm, i, match, base);
+
+	if (i == rm->offset_size && (err = preg_offset_alloc(rm)))
+		return err;
+
+	if (rm->wide) {
+		rm->offset_base[i] = base;
+		memcpy(rm->offset[i], match, rm->subn * sizeof(*match));
+		return 0;
+	}
+
+	for (j = 0; j < rm->subn; j++) {
+		// Regexec returns -1 for subexpressions not matched
+		if (match[j].rm_so != -1) {
+			rm->offset[i][j].rm_so = match[j].rm_so +base;
+			rm->offset[i][j].rm_eo = match[j].rm_eo +base;
+		}
+		else {
+			rm->offset[i][j].rm_so = -1;
+			rm->offset[i][j].rm_eo = -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Returns the match "i" as a row of the offset matrix, whose offsets count
+ * from "*base". A packed match is unpacked to the "match_sc" scratch memory,
+ * so the row is valid until the next call */
+static const regmatch_t* offset_row(Preg* rm, size_t i, size_t* base)
+{
+	regmatch_t* row;
+	size_t so, eo;
+	size_t j;
+
+	if (!rm->packed) {
+		*base = rm->wide ? rm->offset_base[i] : 0;
+		return rm->offset[i];
+	}
+
+	row = scratch_get(rm, &rm->match_sc, (rm->subc +1) * sizeof(*row));
+	if (!row)
+		return NULL;
+
+	*base = rm->wide ? pack_off(rm, i, 0, 0) : 0;
+	for (j = 0; j <= rm->subc; j++) {
+		so = pack_off(rm, i, j, 0);
+		eo = pack_off(rm, i, j, 1);
+		row[j].rm_so = so == (size_t)-1 ? -1 : (regoff_t)(so -*base);
+		row[j].rm_eo = so == (size_t)-1 ? -1 : (regoff_t)(eo -*base);
+	}
+
+	return row;
+}
+
+/* Adds the match "i" to the open block of the packed offsets. The block is
+ * packed once it is complete */
+static int pack_add(Preg* rm, size_t i, const regmatch_t* match, size_t base)
+{
+	size_t nsub = rm->subn;
+	size_t* row;
+	size_t j;
+
+	if (i == 0)
+		rm->pack_len = 0;
+
+	if (i % PACK_BLOCK == 0) {
+		row = scratch_get(rm, &rm->pend_sc,
+		                  PACK_BLOCK * nsub * 2 * sizeof(*row));
+		if (!row)
+			return PREG_MEMFAIL;
+	}
+	row = (size_t*)rm->pend_sc.mem +i % PACK_BLOCK * nsub * 2;
+
+	for (j = 0; j < nsub; j++) {
+		if (match[j].rm_so != -1) {
+			row[2 * j]    = match[j].rm_so +base;
+			row[2 * j +1] = match[j].rm_eo +base;
+		}
+		else
+			row[2 * j] = row[2 * j +1] = -1;
+	}
+
+	if (i % PACK_BLOCK == PACK_BLOCK -1)
+		return pack_flush(rm, i / PACK_BLOCK);
+
+	return 0;
+}
+
+// Packs the complete open block as the block "nblock"
+static int pack_flush(Preg* rm, size_t nblock)
+{
+	size_t nsub = rm->subn;
+	const size_t* row = rm->pend_sc.mem;
+	Pack_block* blk;
+	unsigned char* p;
+	size_t maxso;
+	size_t maxlen = 0;
+	size_t size;
+	size_t k, j;
+
+	blk = scratch_get(rm, &rm->blocks_sc, (nblock +1) * sizeof(*blk));
+	if (!blk)
+		return PREG_MEMFAIL;
+	blk += nblock;
+
+	// A subexpression lies within its match, so its relative start plus one
+	// is no more than the length of the match plus one
+	for (k = 0; k < PACK_BLOCK; k++)
+		if (row[k * nsub * 2 +1] -row[k * nsub * 2] +1 > maxlen)
+			maxlen = row[k * nsub * 2 +1] -row[k * nsub * 2] +1;
+	maxso = row[(PACK_BLOCK -1) * nsub * 2] -row[0];
+
+	blk->base = row[0];
+	blk->pos  = rm->pack_len;
+	blk->wso  = pack_width(maxso);
+	blk->wlen = pack_width(maxlen);
+	blk->rec  = blk->wso +blk->wlen * (nsub * 2 -1);
+	size = PACK_BLOCK * blk->rec;
+
+	if (rm->pack_len +size > rm->pack_sc.size && mem_reserve(rm, size))
+		return PREG_MEMLIMIT;
+
+	p = scratch_get(rm, &rm->pack_sc, rm->pack_len +size);
+	if (!p)
+		return PREG_MEMFAIL;
+	p += rm->pack_len;
+
+	for (k = 0; k < PACK_BLOCK; k++, row += nsub * 2) {
+		pack_put(p, blk->wso, row[0] -blk->base);
+		p += blk->wso;
+		pack_put(p, blk->wlen, row[1] -row[0]);
+		p += blk->wlen;
+
+		for (j = 1; j < nsub; j++) {
+			if (row[2 * j] != (size_t)-1) {
+				pack_put(p, blk->wlen, row[2 * j] -row[0] +1);
+				pack_put(p +blk->wlen, blk->wlen,
+				         row[2 * j +1] -row[2 * j]);
+			}
+			else {
+				pack_put(p, blk->wlen, 0);
+				pack_put(p +blk->wlen, blk->wlen, 0);
+			}
+			p += blk->wlen * 2;
+		}
+	}
+	rm->pack_len += size;
+
+	return 0;
+}
+
+/* Returns the start offset of the subexpression "nsub" of the packed match
+ * "nmatch", or its end offset if "end" is set. Either is (size_t)-1 if the
+ * subexpression did not participate in the match */
+static size_t pack_off(const Preg* rm, size_t nmatch, size_t nsub, int end)
+{
+	const Pack_block* blk;
+	const unsigned char* p;
+	const size_t* row;
+	size_t so;
+	size_t rel;
+
+	// The last, open block is not packed yet
+	if (nmatch / PACK_BLOCK == rm->matc / PACK_BLOCK) {
+		row = (const size_t*)rm->pend_sc.mem +
+		      (nmatch % PACK_BLOCK * rm->subn +nsub) * 2;
+		return row[end];
+	}
+
+	blk = (const Pack_block*)rm->blocks_sc.mem +nmatch / PACK_BLOCK;
+	p = (const unsigned char*)rm->pack_sc.mem +blk->pos +
+	    nmatch % PACK_BLOCK * blk->rec;
+
+	so = blk->base +pack_get(p, blk->wso);
+	p += blk->wso;
+	if (nsub > 0) {
+		p += blk->wlen * (nsub * 2 -1);
+		if (!(rel = pack_get(p, blk->wlen)))
+			return -1;
+		so += rel -1;
+		p += blk->wlen;
+	}
+
+	return end ? so +pack_get(p, blk->wlen) : so;
+}
+
+// The fewest bytes, out of 1, 2, 4 or 8, that hold "max"
+static unsigned char pack_width(size_t max)
+{
+	if (max <= UINT8_MAX)
+		return 1;
+	if (max <= UINT16_MAX)
+		return 2;
+	if (max <= UINT32_MAX)
+		return 4;
+	return 8;
+}
+
+// Stores "val" in "width" bytes
+static void pack_put(unsigned char* p, unsigned char width, size_t val)
+{
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	switch (width) {
+	case 1:
+		*p = val;
+		break;
+	case 2:
+		v16 = val;
+		memcpy(p, &v16, sizeof(v16));
+		break;
+	case 4:
+		v32 = val;
+		memcpy(p, &v32, sizeof(v32));
+		break;
+	default:
+		v64 = val;
+		memcpy(p, &v64, sizeof(v64));
+	}
+}
+
+static size_t pack_get(const unsigned char* p, unsigned char width)
+{
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	switch (width) {
+	case 1:
+		return *p;
+	case 2:
+		memcpy(&v16, p, sizeof(v16));
+		return v16;
+	case 4:
+		memcpy(&v32, p, sizeof(v32));
+		return v32;
+	default:
+		memcpy(&v64, p, sizeof(v64));
+		return v64;
+	}
+}
+
+/* Moves the running offset "*ro" past "match". The search resumes right after
+ * an empty match, so that it always advances */
+static void offset_advance(const char* subject, size_t* ro,
+                           const regmatch_t* match, int* eflags, int* adjacent)
+{
+	*ro += match->rm_eo;
+	*eflags |= REG_NOTBOL;
+	*adjacent = 1;
+
+	if (match->rm_eo == match->rm_so && subject[*ro]) {
+		*ro += char_len(&subject[*ro]);
+		*adjacent = 0;
+	}
+}
+
+/* Returns the length in bytes of the character at "s" */
+static size_t char_len(const char* s)
+{
+	mbstate_t mbs;
+	size_t n;
+
+	if (MB_CUR_MAX == 1 || (unsigned char)*s < 0x80)
+		return 1;
+
+	memset(&mbs, 0, sizeof(mbs));
+	n = mbrlen(s, MB_CUR_MAX, &mbs);
+
+	return n > 0 && n < (size_t)-2 ? n : 1;
+}
+
+/* Same as the regexec() loop of preg_offset(), for patterns that reduce to a
+ * byte class and for literals. The resulting offsets are identical. Such a
+ * search needs no context, so it can also keep within the byte budget of the
+ * call */
+int preg_offset_fixed(Preg* rm, const char* subject, size_t len,
+                      const Fixed* fx)
+{
+	regmatch_t match;
+	const char* end = subject +len;
+	const char* s = subject +rm->next.offset;   // End of the last match
+	const char* at = s;                         // Where the search continues
+	const char* begin;
+	const char* so = s;
+	const char* lim;
+	size_t execs = 0;
+	size_t i;
+	int err;
+
+	// The previous call may have searched past the last match
+	if (rm->step.scan > rm->next.offset)
+		at = subject +rm->step.scan;
+	begin = at;
+
+	// Find and discard matches until reaching the minimum accepted match
+	for (; rm->step.skipped < rm->min; rm->step.skipped++) {
+		if (step_spent(rm, at -begin, execs))
+			goto pause;
+
+		lim = step_end(rm, begin, at, end);
+		so = fixed_find(fx, at, lim, end);
+		execs++;
+		if (so == end) {
+			if (rm->uflags & PREG_STATS)
+				rm->stats.bytes_scanned += end -begin;
+			rm->next.offset = end -subject;
+			rm->next.done = 1;
+			return REG_NOMATCH;
+		}
+		else if (so == lim) {
+			at = lim;
+			goto pause;
+		}
+
+		s = at = fixed_next(fx, so, end);
+		rm->next.index++;
+		rm->next.eflags = REG_NOTBOL;
+	}
+
+	for (i = rm->matc; ; ++i) {
+		if (step_spent(rm, at -begin, execs))
+			goto pause;
+
+		lim = step_end(rm, begin, at, end);
+		so = fixed_find(fx, at, lim, end);
+		execs++;
+		if (so == lim && lim != end) {
+			at = lim;
+			goto pause;
+		}
+		if (so == end || i >= (size_t)rm->limit)
+			break;
+
+		s = at = fixed_next(fx, so, end);
+
+		if (!rm->wide && !rm->packed) {
+			if (i == rm->offset_size) {
+				err = preg_offset_alloc(rm);
+				if (err)
+					return err;
+			}
+			rm->offset[i][0].rm_so = so -subject;
+			rm->offset[i][0].rm_eo = s -subject;
+		}
+		else if ((size_t)(s -so) <= REGOFF_MAX) {
+			match.rm_so = 0;
+			match.rm_eo = s -so;
+			if ((err = offset_store(rm, i, &match, so -subject)))
+				return err;
+		}
+		else
+			return PREG_TOOLARGE;
+		rm->matc++;
+		rm->next.eflags = REG_NOTBOL;
+	}
+
+	rm->next.offset = s -subject;
+	rm->next.index += rm->matc;
+	rm->next.done   = so == end;
+
+	if (rm->uflags & PREG_STATS) {
+		rm->stats.bytes_scanned += so -begin;
+		rm->stats.matches += rm->matc;
+	}
+
+	return (so == end && rm->matc == 0) ? REG_NOMATCH : 0;
+
+pause:
+	rm->next.offset = s -subject;
+	rm->step.scan = at -subject;
+	if (rm->uflags & PREG_STATS)
+		rm->stats.bytes_scanned += at -begin;
+
+	return PREG_INPROGRESS;
+}
+
+/* Makes "pattern" the pattern of the handle, searched as "kind" */
+static int fixed_set(Preg* rm, const char* pattern, Fixed_kind kind)
+{
+	size_t len = strlen(pattern);
+
+	if (!scratch_get(rm, &rm->pat_sc, len +1))
+		return PREG_MEMFAIL;
+	memcpy(rm->pat_sc.mem, pattern, len +1);
+
+	rm->comp_cflags = rm->cflags;
+	rm->re    = NULL;
+	rm->fixed = kind;
+	rm->subc  = 0;
+
+	return 0;
+}
+
+/* Returns a pointer to the first match that starts in [s, lim) or "lim" if
+ * there is none. A literal may end past "lim", but not past "end" */
+static const char* fixed_find(const Fixed* fx, const char* s, const char* lim,
+                              const char* end)
+{
+	if (fx->kind == FIXED_BCLASS)
+		return bclass_find(&fx->bc, s, lim);
+
+	if (end -lim > fx->len -1)
+		end = lim +fx->len -1;
+
+	while (end -s >= fx->len) {
+		s = memchr(s, fx->str[0], end -s -fx->len +1);
+		if (!s)
+			break;
+		if (!memcmp(s +1, fx->str +1, fx->len -1))
+			return s;
+		++s;
+	}
+
+	return lim;
+}
+
+// Returns the end of the match that starts at "so"
+static const char* fixed_next(const Fixed* fx, const char* so, const char* end)
+{
+	if (fx->kind == FIXED_LITERAL)
+		return so +fx->len;
+
+	return fx->bc.plus ? bclass_span(&fx->bc, so +1, end) : so +1;
+}
+
+/* Returns the PREG_LITERAL "pattern" escaped for regcomp(), or NULL on memory
+ * allocation failure */
+static const char* literal_escape(Preg* rm, const char* pattern)
+{
+	const char* specials;
+	size_t len = strlen(pattern);
+	char* res;
+
+	specials = rm->cflags & REG_EXTENDED ? ere_specials : bre_specials;
+
+	res = scratch_get(rm, &rm->lit_sc, escape(NULL, pattern, len, specials) +1);
+	if (res)
+		escape(res, pattern, len, specials);
+
+	return res;
+}
+
+/* Returns where a byte class search from "s" shall stop, so that the call
+ * that started searching at "begin" keeps within its byte budget */
+static const char* step_end(const Preg* rm, const char* begin, const char* s,
+                            const char* end)
+{
+	size_t left;
+
+	if (!rm->step.bytes)
+		return end;
+
+	left = rm->step.bytes -(s -begin);
+
+	return (size_t)(end -s) > left ? s +left : end;
+}
+
+int preg_offset_alloc(Preg* rm)
+{
+	regmatch_t** offset;
+	size_t* base;
+	void* mem;
+	size_t old_size;
+	size_t new_size;
+	size_t offs_elem_size = (rm->offset_subc +1) * sizeof(regmatch_t);
+	size_t base_size = rm->wide ? sizeof(size_t) : 0;
+	size_t i;
+
+	old_size = rm->offset_size;
+	new_size = old_size ? old_size * MEM_GROWTH_FACTOR : 1;
+
+	if (mem_reserve(rm, (new_size -old_size) *
+	                    (sizeof(regmatch_t*) +base_size +offs_elem_size)))
+		return PREG_MEMLIMIT;
+
+    offset = preg_realloc(&rm->alloc, rm->offset,
+                          new_size * sizeof(regmatch_t*));
+    if (!offset)
+	    return PREG_MEMFAIL;
+	rm->offset = offset;
+
+	if (rm->wide) {
+		base = preg_realloc(&rm->alloc, rm->offset_base, new_size * base_size);
+		if (!base)
+			return PREG_MEMFAIL;
+		rm->offset_base = base;
+	}
+
+    mem = mem_block(rm, (new_size -old_size) * offs_elem_size);
+    if (!mem)
+	    return PREG_MEMFAIL;
+
+	for (i = old_size; i < new_size; ++i)
+		offset[i] = mem_alloc(&mem, offs_elem_size);
+
+	rm->offset_size = new_size;
+
+    return 0;
+}
+
+/* Makes room for the bases of the rows of the offset matrix. Only a "wide"
+ * subject needs them, so they are allocated when one is first searched */
+static int offset_widen(Preg* rm)
+{
+	size_t* base;
+
+	if (!rm->offset_size)
+		return 0;
+
+	base = preg_realloc(&rm->alloc, rm->offset_base,
+	                    rm->offset_size * sizeof(size_t));
+	if (!base)
+		return PREG_MEMFAIL;
+	rm->offset_base = base;
+
+	return 0;
+}
+
+/* Works out the columns of the offset rows from "sel", the subexpressions that
+ * PREG_SUBMASK selects for the operation. The match itself is always kept.
+ * regexec() is asked for no more subexpressions than the last selected one,
+ * and the rows are made wide enough for the selected ones */
+static void sub_select(Preg* rm)
+{
+	size_t last = rm->subc < SUBMASK_MAX ? rm->subc : SUBMASK_MAX;
+	unsigned all = (2u << last) -1;
+	size_t j;
+
+	rm->subn  = rm->subc +1;
+	rm->execn = rm->subc +1;
+
+	if (rm->sel) {
+		rm->sel = (rm->sel | 1) & all;
+		if (rm->sel == all && rm->subc <= SUBMASK_MAX)
+			rm->sel = 0;
+	}
+
+	if (rm->sel) {
+		rm->subn = 0;
+		for (j = 0; j <= last; j++) {
+			if (rm->sel >> j & 1) {
+				rm->subcol[j] = rm->subn++;
+				rm->execn = j +1;
+			}
+		}
+	}
+
+	// Rows sized for fewer subexpressions can't be reused
+	if (rm->subn > rm->offset_subc +1) {
+		rm->offset_size = 0;
+		rm->offset_subc = rm->subn -1;
+	}
+}
+
+/* Moves the selected subexpressions of "match" to their columns. A column is
+ * never past its subexpression, so they are moved in place */
+static void sub_gather(const Preg* rm, regmatch_t* match)
+{
+	size_t j;
+
+	for (j = 1; j < rm->execn; j++)
+		if (rm->sel >> j & 1)
+			match[rm->subcol[j]] = match[j];
+}
+
+/* Turns the subexpression "*nsub" into its column of the offset rows. Returns
+ * 0 if PREG_SUBMASK left it out of the results */
+static inline int sub_selected(const Preg* rm, size_t* nsub)
+{
+	if (*nsub > SUBMASK_MAX || !(rm->sel >> *nsub & 1))
+		return 0;
+
+	*nsub = rm->subcol[*nsub];
+	return 1;
+}
+
+/* Performs a regex match on a given string and stores the resulting strings.
+ *
+ * Parameters:
+ * Preg* rm:			A Preg structure where the results will be saved
+ * const char* subject: The string on which the regex search is performed
+ * const char* pattern:	The regex pattern
+ *
+ * On success it returns 0. Else it returns an error code.
+ */
+int preg_match(Preg* rm, const char* subject, const char* pattern)
+{
+	preg_set_mode(rm, PREG_MATCH);
+
+	return match_strings(rm, subject, pattern, rm->submask);
+}
+
+/* preg_match() with the subexpressions of "submask" (see preg_offset()).
+ * preg_replace() takes every subexpression, as its backreferences may refer
+ * to any of them */
+static int match_strings(Preg* rm, const char* subject, const char* pattern,
+                         int submask)
+{
+	Preg_sub* match = NULL;
+	size_t memsize = 0;
+	size_t match_size;
+	void* mem;
+	int err;
+
+	if ((err = preg_offset(rm, subject, pattern, submask)))
+		goto end;
+
+	// Does the user want the matched strings?
+	if (rm->uflags & PREG_NOSTRINGS)
+		goto end;
+
+	// Calculate the size of the relevant structures
+	match_size = preg_matc(rm) * sizeof(Preg_sub);
+
+	memsize += match_size;
+	memsize += matches_size(rm, 0, preg_matc(rm));
+
+	// One-time allocation
+	if ((err = mem_reserve(rm, memsize)))
+		goto end;
+
+	if ((mem = mem_init(rm, memsize)) == NULL) {
+		err = PREG_MEMFAIL;
+		goto end;
+	}
+
+	match = mem_alloc(&mem, match_size);
+
+	// Copy the matched strings to the appropriate structures
+	matches_copy(rm, subject, match, 0, preg_matc(rm), &mem);
+	rm->matches.cap  = preg_matc(rm);
+	rm->matches.dead = 0;
+
+end:
+	rm->matches.match = match;
+	err = preg_set_error(rm, err);
+
+	return err;
+}
+
+/* Returns the memory needed for the submatch arrays and the strings of the
+ * matches in [from, to) */
+static size_t matches_size(const Preg* rm, size_t from, size_t to)
+{
+	size_t size;
+	size_t i, j;
+
+	size = (to -from) * rm->subn * sizeof(char*);
+
+	// Calculate the total length of the matched strings
+	if (rm->packed)
+		for (i = from; i < to; ++i)
+			for (j = 0; j < rm->subn; ++j)
+				size += sub_len(rm, i, j) +1;
+	else
+		for (i = from; i < to; ++i)
+			for (j = 0; j < rm->subn; ++j)
+				size += rm->offset[i][j].rm_eo -rm->offset[i][j].rm_so +1;
+
+	return size;
+}
+
+/* Copies the matched strings of the matches in [from, to) to "match", using
+ * the memory pointed by "mem" (see matches_size()) */
+static void matches_copy(const Preg* rm, const char* subject, Preg_sub* match,
+                         size_t from, size_t to, void** mem)
+{
+	size_t sub_size = rm->subn * sizeof(char*);
+	size_t so;
+	size_t len;
+	size_t i, j;
+
+	// Packed offsets get a loop of their own, so that the loop of the offset
+	// matrix stays as tight as it was without them
+	if (rm->packed) {
+		for (i = from; i < to; ++i) {
+			match[i].sub = mem_alloc(mem, sub_size);
+
+			for (j = 0; j < rm->subn; ++j) {
+				so  = pack_off(rm, i, j, 0);
+				len = pack_off(rm, i, j, 1) -so;
+
+				match[i].sub[j] = mem_alloc(mem, len +1);
+				if (len)
+					memcpy(match[i].sub[j], &subject[so], len);
+				match[i].sub[j][len] = '\0';
+			}
+		}
+		return;
+	}
+
+	for (i = from; i < to; ++i) {
+		match[i].sub = mem_alloc(mem, sub_size);
+
+		for (j = 0; j < rm->subn; ++j) {
+			so  = rm->offset[i][j].rm_so;
+			len = rm->offset[i][j].rm_eo -so;
+
+			match[i].sub[j] = mem_alloc(mem, len +1);
+
+			// Subexpressions not matched are left empty
+			if (len) {
+				if (rm->wide)
+					so += rm->offset_base[i];
+				memcpy(match[i].sub[j], &subject[so], len);
+			}
+			match[i].sub[j][len] = '\0';
+		}
+	}
+}
+
+/* Performs the full preg_match() preg_rematch() falls back on. Like the rest
+ * of preg_rematch(), it is never split by the budget of PREG_STEPBYTES and
+ * PREG_STEPEXECS, and it is bound by the deadline preg_rematch() started */
+static int rematch_full(Preg* rm, const char* subject, const char* pattern)
+{
+	Preg_step step = rm->step;
+	uint64_t timeout = rm->timeout;
+	uint64_t now;
+	int err;
+
+	if (rm->deadline) {
+		now = preg_clock();
+		rm->timeout = rm->deadline > now ? rm->deadline -now : 1;
+	}
+	rm->step.bytes = 0;
+	rm->step.execs = 0;
+	err = preg_match(rm, subject, pattern);
+	rm->step.bytes = step.bytes;
+	rm->step.execs = step.execs;
+	rm->timeout = timeout;
+
+	return err;
+}
+
+/* Updates the results of a previous preg_match() on "rm" after an edit of
+ * its subject, without rescanning all of it. "subject" is the edited subject,
+ * where "deleted" bytes starting at "offset" were replaced by "inserted"
+ * bytes. "pattern" and the options of "rm" shall be the same as the ones of
+ * the previous preg_match().
+ *
+ * The scan restarts from the last match that could not have been affected by
+ * the edit and stops as soon as a match ends where an old match ended after
+ * the edit, as from then on the results are the old ones shifted. Under
+ * REG_NEWLINE that match shall end past the edited bytes. When the pattern
+ * has no upper match length or the previous results cannot be updated, a full
+ * preg_match() is performed.
+ *
+ * On success it returns 0. Else it returns an error code.
+ */
+int preg_rematch(Preg* rm, const char* subject, const char* pattern,
+                 size_t offset, size_t deleted, size_t inserted)
+{
+	Preg_sub* old_match = rm->matches.match;
+	Preg_sub* match = NULL;
+	size_t old_matc = preg_matc(rm);
+	size_t cap = old_match ? rm->matches.cap : 0;
+	size_t dead = rm->matches.dead;
+	size_t keep;
+	size_t tail;
+	size_t nfound;
+	size_t memsize;
+	void* mem;
+	int err;
+	size_t i, j;
+
+	timeout_start(rm);
+
+	// The edit invalidates a search in progress
+	rm->step.subject = NULL;
+
+	// Only the results of a complete global match can be updated. Keeping
+	// a match needs an upper bound on the match length, while empty matches
+	// would need the adjacency rule of preg_offset(). The offsets of a subject
+	// larger than REGOFF_MAX count from their own bases instead, and packed
+	// offsets cannot be moved in place. PREG_SUBMASK is left to preg_offset()
+	if (rm->mode != PREG_MATCH || !rm->re || rm->uflags & PREG_LITERAL ||
+	    rm->wide || rm->sublen +inserted -deleted > REGOFF_MAX ||
+	    rm->packed || rm->sel || rm->submask ||
+	    rm->min || rm->limit != -1 ||
+	    rm->start || !*pattern || strcmp(rm->pat_sc.mem, pattern) ||
+	    rm->info.maxlen == ANALYZE_UNBOUNDED || rm->info.empty ||
+	    (preg_errcode(rm) && preg_errcode(rm) != REG_NOMATCH) ||
+	    (!(rm->uflags & PREG_NOSTRINGS) && old_matc && !old_match))
+		return rematch_full(rm, subject, pattern);
+
+	// Old matches whose search never reached the edited text are kept
+	for (keep = 0; keep < old_matc &&
+	     (size_t)preg_start(rm, keep, 0) +rm->info.maxlen < offset; ++keep)
+		;
+
+	err = rematch_scan(rm, subject, keep ? preg_end(rm, keep -1, 0) : 0, keep,
+	                   offset, deleted, inserted);
+	if (err < 0)
+		goto end;
+	rm->sublen += inserted -deleted;
+
+	// rematch_scan() returns the first old match that was kept after the edit
+	tail = err;
+	err = 0;
+	nfound = preg_matc(rm) -keep -(old_matc -tail);
+
+	preg_set_mode(rm, PREG_MATCH);
+
+	if (!preg_matc(rm))
+		err = REG_NOMATCH;
+
+	if (err || rm->uflags & PREG_NOSTRINGS)
+		goto end;
+
+	// The strings of the dropped old matches stay in the arena, unused
+	for (i = keep; old_match && i < tail; ++i)
+		for (j = 0; j < rm->subn; ++j)
+			dead += sizeof(char*) +strlen(old_match[i].sub[j]) +1;
+
+	// The kept matches are moved in place, unless the array is full
+	if (preg_matc(rm) <= cap) {
+		match = old_match;
+		memmove(&match[keep +nfound], &old_match[tail],
+		        (old_matc -tail) * sizeof(Preg_sub));
+	}
+	else {
+		dead += cap * sizeof(Preg_sub);
+		cap = preg_matc(rm) +preg_matc(rm) / 2;
+		if ((err = mem_reserve(rm, cap * sizeof(Preg_sub))))
+			goto end;
+
+		if ((match = mem_init(rm, cap * sizeof(Preg_sub))) == NULL) {
+			err = PREG_MEMFAIL;
+			goto end;
+		}
+
+		for (i = 0; i < keep; ++i)
+			match[i] = old_match[i];
+		for (i = tail; i < old_matc; ++i)
+			match[i -tail +keep +nfound] = old_match[i];
+	}
+
+	// Once most of the arena is unused, all of the results are copied anew,
+	// which is paid for by the edits that dropped them
+	if (dead > (rm->results.used +rm->results.extra_size) / 2) {
+		match = NULL;
+		mem_reset(rm);
+		cap  = preg_matc(rm);
+		dead = 0;
+
+		memsize = cap * sizeof(Preg_sub) +matches_size(rm, 0, cap);
+		if ((err = mem_reserve(rm, memsize)))
+			goto end;
+
+		if ((mem = mem_init(rm, memsize)) == NULL) {
+			err = PREG_MEMFAIL;
+			goto end;
+		}
+
+		match = mem_alloc(&mem, cap * sizeof(Preg_sub));
+		matches_copy(rm, subject, match, 0, cap, &mem);
+		goto end;
+	}
+
+	// Only the strings of the rescanned matches are copied
+	memsize = matches_size(rm, keep, keep +nfound);
+	if ((err = mem_reserve(rm, memsize)))
+		goto end;
+
+	if ((mem = mem_init(rm, memsize)) == NULL) {
+		err = PREG_MEMFAIL;
+		goto end;
+	}
+
+	matches_copy(rm, subject, match, keep, keep +nfound, &mem);
+
+end:
+	if (err)
+		match = NULL;
+	rm->matches.match = match;
+	rm->matches.cap   = cap;
+	rm->matches.dead  = dead;
+	err = preg_set_error(rm, err);
+
+	return err;
+}
+
+/* Scans "subject" from "ro", which is the end of the old match "keep -1",
+ * until the matches resynchronize with the old ones after the edit, and
+ * updates the offset matrix. Returns the index of the first old match kept
+ * after the edit or an error code */
+static int rematch_scan(Preg* rm, const char* subject, size_t ro, size_t keep,
+                        size_t offset, size_t deleted, size_t inserted)
+{
+	regmatch_t* found = rm->found_sc.mem;   // Offsets of the rescanned matches
+	regmatch_t* temp;
+	regmatch_t** row;
+	size_t nsub = preg_subc(rm) +1;
+	size_t old_matc = preg_matc(rm);
+	size_t nfound = 0;
+	size_t tail = keep;
+	size_t start = ro;
+	size_t old_eo = 0;
+	size_t src, dst, n;
+	int eflags = keep ? REG_NOTBOL : 0;
+	int adjacent = 0;
+	int err;
+	int i, j;
+
+	for (;;) {
+		found = scratch_get(rm, &rm->found_sc,
+		                    (nfound +1) * nsub * sizeof(regmatch_t));
+		if (!found)
+			return PREG_MEMFAIL;
+
+		// The length of the subject is not needed, as it only lets
+		// offset_exec() give up earlier
+		err = offset_exec(rm, subject, ANALYZE_UNBOUNDED, &ro,
+		                  &found[nfound * nsub], &eflags, &adjacent);
+		if (err)
+			break;
+
+		for (j = 0; j < nsub; j++) {
+			if (found[nfound * nsub +j].rm_so != -1) {
+				found[nfound * nsub +j].rm_so += ro;
+				found[nfound * nsub +j].rm_eo += ro;
+			}
+		}
+		ro = found[nfound * nsub].rm_eo;
+		eflags |= REG_NOTBOL;
+		nfound++;
+
+		// Past the edit, the scan continues as it did before once a match
+		// ends where an old one ended. Under REG_NEWLINE the byte before
+		// that point shall be an unedited one too, as it decides whether
+		// the next search starts at a line start
+		if (ro < offset +inserted ||
+		    (rm->cflags & REG_NEWLINE && ro == offset +inserted))
+			continue;
+
+		for (; tail < old_matc; ++tail) {
+			old_eo = preg_eo(rm, tail, 0);
+			if (old_eo >= offset +deleted &&
+			    old_eo -deleted +inserted >= ro)
+				break;
+		}
+
+		if (tail < old_matc && old_eo -deleted +inserted == ro) {
+			tail++;
+			break;
+		}
+	}
+
+	if (err == REG_NOMATCH)
+		tail = old_matc;
+	else if (err)
+		return err;
+
+	rm->stats.bytes_scanned += rm->uflags & PREG_STATS ? ro -start : 0;
+	rm->stats.matches += rm->uflags & PREG_STATS ? nfound : 0;
+
+	while (rm->offset_size < keep +nfound +(old_matc -tail))
+		if ((err = preg_offset_alloc(rm)))
+			return err;
+
+	// Move the rows of the kept old matches next to the rescanned ones. The
+	// rows are swapped so that none of them is lost
+	row = rm->offset;
+	src = tail;
+	dst = keep +nfound;
+	n   = old_matc -tail;
+	if (dst < src)
+		for (i = 0; i < n; ++i) {
+			temp = row[dst +i];
+			row[dst +i] = row[src +i];
+			row[src +i] = temp;
+		}
+	else if (dst > src)
+		for (i = n -1; i >= 0; --i) {
+			temp = row[dst +i];
+			row[dst +i] = row[src +i];
+			row[src +i] = temp;
+		}
+
+	for (i = 0; i < nfound; ++i)
+		memcpy(row[keep +i], &found[i * nsub], nsub * sizeof(regmatch_t));
+
+	for (i = dst; i < dst +n; ++i)
+		for (j = 0; j < nsub; j++)
+			if (row[i][j].rm_so != -1) {
+				row[i][j].rm_so += (regoff_t)inserted -(regoff_t)deleted;
+				row[i][j].rm_eo += (regoff_t)inserted -(regoff_t)deleted;
+			}
+
+	rm->matc = dst +n;
+
+	rm->next.offset = rm->matc ? preg_eo(rm, rm->matc -1, 0) : 0;
+	rm->next.eflags = rm->matc ? REG_NOTBOL : 0;
+	rm->next.index  = rm->matc;
+	rm->next.done   = 1;
+	rm->next.adjacent = rm->matc > 0;
+
+	return tail;
+}
+
+static int lines_append(Preg* rm, size_t start)
+{
+	size_t* lines;
+	size_t new_size;
+
+	if (rm->linec == rm->lines_size) {
+		new_size = rm->lines_size ? rm->lines_size * MEM_GROWTH_FACTOR : 64;
+
+		if (mem_reserve(rm, (new_size -rm->lines_size) * sizeof(size_t)))
+			return PREG_MEMLIMIT;
+
+		lines = preg_realloc(&rm->alloc, rm->lines, new_size * sizeof(size_t));
+		if (!lines)
+			return PREG_MEMFAIL;
+
+		rm->lines = lines;
+		rm->lines_size = new_size;
+	}
+
+	rm->lines[rm->linec++] = start;
+
+	return 0;
+}
+
+/* Appends to the line index the lines that start after the newlines found in
+ * [from, to) of "subject", whose length is "len" */
+static int lines_scan(Preg* rm, const char* subject, size_t from, size_t to,
+                      size_t len)
+{
+	const char* nl;
+	int err;
+
+	while (from < to && (nl = memchr(&subject[from], '\n', to -from))) {
+		from = nl -subject +1;
+
+		if (from < len && (err = lines_append(rm, from)))
+			return err;
+	}
+
+	return 0;
+}
+
+/* Builds the line index of "subject", so that offsets can be mapped to lines
+ * and columns with preg_linecol().
+ *
+ * On success it returns 0. Else it returns an error code.
+ */
+int preg_lines(Preg* rm, const char* subject)
+{
+	size_t len = strlen(subject);
+	int err;
+
+	rm->linec = 0;
+
+	if (!(err = lines_append(rm, 0)))
+		err = lines_scan(rm, subject, 0, len, len);
+
+	return preg_set_error(rm, err);
+}
+
+/* Finds the lines of "subject" that match "pattern", which is compiled with
+ * REG_NEWLINE, in a single pass. The offset matrix holds the first match of
+ * every matching line and the line index of "subject" is built along the way.
+ *
+ * Every regexec() call starts at the beginning of a line and returns the
+ * first match in it or in any following line, so non matching lines cost no
+ * extra calls.
+ *
+ * On success it returns 0. Else it returns an error code.
+ */
+int preg_grep(Preg* rm, const char* subject, const char* pattern)
+{
+	regmatch_t* match = NULL;
+	const char* nl;
+	size_t len;
+	size_t ro = 0;              // Running offset, always at a line start
+	size_t base;
+	size_t so;
+	size_t win;
+	int skipped = 0;
+	int lines_err;
+	int err;
+	size_t i = 0;
+
+	timeout_start(rm);
+	preg_set_mode(rm, PREG_GREP);
+
+	rm->matc  = 0;
+	rm->linec = 0;
+	rm->start = 0;
+	rm->packed = !!(rm->uflags & PREG_COMPACT);
+	rm->sel = 0;
+	rm->step.subject = NULL;
+	mem_reset(rm);
+
+	if ((err = preg_checkopt(rm)))
+		goto end;
+
+	err = preg_comp(rm, pattern, (rm->cflags | REG_NEWLINE) & ~REG_NOSUB);
+	if (err)
+		goto end;
+	sub_select(rm);
+
+	len = strlen(subject);
+	rm->wide   = len > REGOFF_MAX;
+	rm->sublen = len;
+	if (rm->wide && (err = offset_widen(rm)))
+		goto end;
+
+	if ((err = lines_append(rm, 0)))
+		goto end;
+
+	match = scratch_get(rm, &rm->match_sc, (rm->subc +1) * sizeof(*match));
+	if (!match) {
+		err = PREG_MEMFAIL;
+		goto end;
+	}
+
+	while (i < (size_t)rm->limit) {
+		err = window_exec(rm, &subject[ro], len -ro, match, 0, &win);
+		if (err == REG_NOMATCH && win < len -ro) {
+			// The next window starts at a line too
+			if ((err = lines_scan(rm, subject, ro, ro +win, len)))
+				goto end;
+			ro += win;
+			continue;
+		}
+		if (err)
+			break;
+
+		base = ro;
+		so = base +match->rm_so;
+
+		// Index the lines up to the matching one and resume from the next
+		nl = memchr(&subject[so], '\n', len -so);
+		ro = nl ? nl -subject +1 : len;
+
+		if ((err = lines_scan(rm, subject, base, ro, len)))
+			goto end;
+
+		if (skipped < rm->min)
+			skipped++;
+		else {
+			if ((err = offset_store(rm, i, match, base)))
+				goto end;
+			rm->matc = ++i;
+		}
+
+		if (ro >= len)
+			break;
+	}
+
+	if (err == REG_NOMATCH && i > 0)
+		err = 0;
+
+	// Complete the line index
+	if (ro < len && (lines_err = lines_scan(rm, subject, ro, len, len)))
+		err = lines_err;
+
+	if (rm->uflags & PREG_STATS) {
+		rm->stats.bytes_scanned += len;
+		rm->stats.matches += rm->matc;
+	}
+
+end:
+	return preg_set_error(rm, err);
+}
 
-	rm->err = internal_errors[ERRCODE_POS(err)];
+int preg_split(Preg* rm, const char* subject, const char* pattern)
+{
+	void* mem;
+	String* split = NULL;
+	size_t split_size = 0;
+	size_t prev_eo;
+	size_t len;
+	size_t len_total = 0;
+	int err;
+	size_t i;
 
-	errmsg_len = strlen(errmsg);
-	errdet_len = strlen(errdet);
+	preg_set_mode(rm, PREG_SPLIT);
 
-	rm->err.errmsg = mem_init(rm, errmsg_len +errdet_len +3);
-	if (!rm->err.errmsg) {
-		preg_set_internal_error(rm, PREG_MEMFAIL);
+	if ((err = preg_offset(rm, subject, pattern, 0)))
+		goto end;
+
+	// Allocate the max size needed for all the split string segments
+	if ((err = mem_reserve(rm, (preg_matc(rm) +1) * sizeof(String))))
+		goto end;
+
+	split = mem_init(rm, (preg_matc(rm) +1) * sizeof(String));
+	if (!split) {
+		err = PREG_MEMFAIL;
+		goto end;
+	}
+
+	// Calculate the total size needed for all the split segments. Store their
+	// lengths and start pointers
+	prev_eo = rm->start;
+	for (i = 0; i <= preg_matc(rm); ++i) {
+		if (i == preg_matc(rm))
+			len = strlen(&subject[prev_eo]);
+		else
+			len = preg_start(rm, i, 0) -prev_eo;
+
+		if (len) {
+			split[split_size].str = (char*)&subject[prev_eo];
+			split[split_size].len = len;
+
+			len_total += len +1;
+
+			split_size++;
+		}
+
+		if (i != preg_matc(rm))
+			prev_eo = preg_end(rm, i, 0);
+	}
+
+	// One time allocation
+	if ((err = mem_reserve(rm, len_total)))
+		goto end;
+
+	if ((mem = mem_init(rm, len_total)) == NULL) {
+		err = PREG_MEMFAIL;
+		goto end;
+	}
+
+	// Iterate a second time over the results and store the resulting strings
+	for (i = 0; i < split_size; ++i) {
+		void* temp = split[i].str;
+
+		split[i].str = mem_alloc(&mem, split[i].len +1);
+		memcpy(split[i].str, temp, split[i].len);
+		split[i].str[split[i].len] = '\0';
+	}
+
+end:
+	rm->splits.split = split;
+	rm->splits.size = split_size;
+
+	err = preg_set_error(rm, err);
+	return err;
+}
+
+/* Appends a field of the current record to the fields of the scan. Empty
+ * fields are dropped, as in preg_split() */
+static int columns_field(Preg* rm, Columns_scan* cs, size_t off, size_t len)
+{
+	size_t* field;
+
+	if (!len)
+		return 0;
+
+	field = scratch_get(rm, &rm->fields_sc,
+	                    (cs->nfields +1) * 2 * sizeof(size_t));
+	if (!field)
+		return PREG_MEMFAIL;
+
+	field[cs->nfields * 2]    = off;
+	field[cs->nfields * 2 +1] = len;
+	cs->nfields++;
+	cs->cur++;
+
+	return 0;
+}
+
+/* Ends the current record of the scan, which starts a new one at "next" */
+static int columns_record(Preg* rm, Columns_scan* cs, size_t next)
+{
+	size_t* fieldc;
+
+	fieldc = scratch_get(rm, &rm->recs_sc, (cs->recc +1) * sizeof(size_t));
+	if (!fieldc)
 		return PREG_MEMFAIL;
+
+	fieldc[cs->recc++] = cs->cur;
+	if (cs->cur > cs->colc)
+		cs->colc = cs->cur;
+	cs->cur = 0;
+	cs->start = next;
+
+	return 0;
+}
+
+/* Finds the first newline of "subject" at or after "from" */
+static void columns_nextnl(Columns_scan* cs, const char* subject, size_t from)
+{
+	const char* nl = memchr(&subject[from], '\n', cs->len -from);
+
+	cs->nl = nl ? nl -subject : cs->len;
+}
+
+/* Splits the segment of "subject" from "from" to "to", which includes no
+ * match of the pattern, into fields at the record boundaries */
+static int columns_segment(Preg* rm, Columns_scan* cs, const char* subject,
+                           size_t from, size_t to)
+{
+	int err;
+
+	while (cs->nl < to) {
+		if ((err = columns_field(rm, cs, from, cs->nl -from)))
+			return err;
+		from = cs->nl +1;
+		if ((err = columns_record(rm, cs, from)))
+			return err;
+		columns_nextnl(cs, subject, from);
 	}
-	memcpy(rm->err.errmsg, errmsg, errmsg_len);
-	memcpy(&rm->err.errmsg[errmsg_len], ": ", 2);
-	memcpy(&rm->err.errmsg[errmsg_len +2], errdet, errdet_len +1);
 
+	return columns_field(rm, cs, from, to -from);
+}
+
+/* Splits every line of "subject" like preg_split() and stores the fields in
+ * columns: the nth field of every record is stored in the nth column */
+int preg_split_columns(Preg* rm, const char* subject, const char* pattern)
+{
+	Columns_scan cs = { 0, 0, 0, 0, 0, 0, 0 };
+	Preg_columns cols = { NULL, NULL, NULL, 0, 0 };
+	const size_t* field;
+	const size_t* fieldc;
+	size_t prev_eo;
+	size_t so, eo;
+	size_t len;
+	size_t cells;
+	size_t r, c, k;
+	int newline = rm->cflags & REG_NEWLINE;
+	int err;
+	size_t i;
+
+	preg_set_mode(rm, PREG_COLUMNS);
+
+	// Matches shall not span records
+	rm->cflags |= REG_NEWLINE;
+	err = preg_offset(rm, subject, pattern, 0);
+	if (!newline)
+		rm->cflags &= ~REG_NEWLINE;
+	if (err)
+		goto end;
+
+	len = cs.len = strlen(subject);
+	prev_eo = cs.start = rm->start;
+	columns_nextnl(&cs, subject, prev_eo);
+	for (i = 0; i <= preg_matc(rm); ++i) {
+		so = i == preg_matc(rm) ? len : (size_t)preg_start(rm, i, 0);
+		eo = i == preg_matc(rm) ? len : (size_t)preg_end(rm, i, 0);
+
+		if ((err = columns_segment(rm, &cs, subject, prev_eo, so)))
+			goto end;
+
+		// A match may still include a record boundary, e.g. "[ \n]"
+		while (cs.nl < eo) {
+			if ((err = columns_record(rm, &cs, cs.nl +1)))
+				goto end;
+			columns_nextnl(&cs, subject, cs.nl +1);
+		}
+
+		prev_eo = eo;
+	}
+
+	// The last record may not be terminated by a newline
+	if (cs.start < len && (err = columns_record(rm, &cs, len)))
+		goto end;
+
+	cells = cs.recc * cs.colc;
+	if ((err = mem_reserve(rm, (cs.recc +2 * cells) * sizeof(size_t))))
+		goto end;
+
+	cols.fieldc = mem_init(rm, (cs.recc +2 * cells) * sizeof(size_t));
+	if (!cols.fieldc) {
+		err = PREG_MEMFAIL;
+		goto end;
+	}
+	cols.off  = cols.fieldc +cs.recc;
+	cols.len  = cols.off +cells;
+	cols.recc = cs.recc;
+	cols.colc = cs.colc;
+
+	// The fields missing from short records are left empty
+	memset(cols.off, 0, 2 * cells * sizeof(size_t));
+
+	field  = rm->fields_sc.mem;
+	fieldc = rm->recs_sc.mem;
+	for (r = 0, k = 0; r < cs.recc; ++r) {
+		cols.fieldc[r] = fieldc[r];
+		for (c = 0; c < fieldc[r]; ++c, ++k) {
+			cols.off[c * cs.recc +r] = field[k * 2];
+			cols.len[c * cs.recc +r] = field[k * 2 +1];
+		}
+	}
+
+end:
+	rm->cols = cols;
+
+	err = preg_set_error(rm, err);
 	return err;
 }
 
-/* If len == -1 preg_escape expects a null terminated string. Else the first len
- * bytes will be escaped */
-char* preg_escape(const char* str, Preg_notation notation, size_t len)
+int preg_replace(Preg* rm, const char* subject, const char* pattern,
+				 const char* rep)
 {
-	unsigned int i;
-	const char* bre_specials = "^$.[*\\";
-	const char* ere_specials = "^$.[()|*+?{\\";
-	const char* special_char;
-	char* res;
-	size_t index = 0;
-	size_t nlen = 0;
+	String res;
+	String nrep;
+	bref_vec* bref = &rm->bref;
+	char errdtls[MAX_BREF_DIGITS +1] = "";
+	int err = 0;
+	int i;
 
-	switch (notation) {
-		case PREG_BRE:
-			special_char = bre_specials;
-			break;
-		case PREG_ERE:
-			special_char = ere_specials;
+	timeout_start(rm);
+	mem_reset(rm);
+
+	bref->n = 0;
+	nrep.str = scratch_get(rm, &rm->rep_sc, strlen(rep) +1);
+	if (!nrep.str) {
+		err = PREG_MEMFAIL;
+		goto end;
 	}
 
-	if (len == -1)
-		len = strlen(str);
+	if ((err = parse_rep(rep, &nrep, bref)))
+		goto end;
 
-	for (i = 0; i < len; ++i) {
-		if (strchr(special_char, str[i]))
-			++nlen;
-		++nlen;
+#ifdef PARALLEL_REPLACE
+	// Large subjects are replaced part by part by several threads
+	if (rm->threads > 1 && !rm->min && rm->limit == -1 && !rm->resume &&
+	    !rm->step.bytes && !rm->step.execs && !(rm->uflags & PREG_LITERAL)) {
+		err = replace_parallel(rm, subject, pattern, &nrep, &res, errdtls);
+		if (err != PREG_NOACTION) {
+			if (!err) {
+				preg_set_mode(rm, PREG_REPLACE);
+				rm->rep = res;
+			}
+			goto end;
+		}
+		err = 0;
 	}
+#endif
 
-	res = malloc(nlen +1);
-	if (!res)
-		return NULL;
+	// If the replacement string includes backreferences
+	if (bref->n > 0) {
 
-	for (i = 0; i < len; ++i) {
-		if (strchr(special_char, str[i]))
-			res[index++] = '\\';
-		res[index++] = str[i];
+		// PREG_NOSTRINGS will cause conflicts here
+		if (rm->uflags & PREG_NOSTRINGS)
+			rm->uflags &= ~PREG_NOSTRINGS;
+
+		// We need the matched strings for applying them to the backreferences
+		// in the replacement string
+		preg_set_mode(rm, PREG_MATCH);
+		if ((err = match_strings(rm, subject, pattern, 0)))
+			goto end;
+
+		// Check for invalid backreference numbers
+		for (i = 0; i < bref->n; i++) {
+			if (bref->entry[i].no > preg_subc(rm)) {
+				snprintf(errdtls, MAX_BREF_DIGITS +1, "%d", bref->entry[i].no);
+				err = PREG_BADBREF;
+				goto end;
+			}
+		}
 	}
-	res[index] = '\0';
+	else
+		if ((err = preg_offset(rm, subject, pattern, 0)))
+			goto end;
 
-	return res;
+	if ((err = assemble(rm, subject, &nrep, bref, &res)))
+		goto end;
+
+	preg_set_mode(rm, PREG_REPLACE);
+
+	rm->rep = res;
+
+end:
+	err = preg_set_error(rm, err, errdtls);
+
+	return err;
 }
 
-/* Performs a regex match on a given string and stores the results in the
- * "offset" array inside "rm".
- *
- * Parameters:
- * Preg* rm:			An initialized Preg structure
- * const char* subject: The string on which the regex search is performed
- * const char* pattern:	The regex pattern
+#ifdef PARALLEL_REPLACE
+/* Performs preg_replace() with up to "threads" threads. The subject is split
+ * into parts at line starts. Every thread finds the matches of a part and the
+ * length of its output. The offsets of the outputs in the result follow from
+ * the lengths, so the threads then copy their outputs concurrently. The
+ * result is identical to the one of the serial preg_replace().
  *
- * On success it returns 0. Else it returns an error code.
- */
-int preg_offset(Preg* rm, const char* subject, const char* pattern)
+ * It returns PREG_NOACTION if the subject is too short or a match of the
+ * pattern may contain a newline, in which case it may span parts. */
+static int replace_parallel(Preg* rm, const char* subject, const char* pattern,
+                            const String* rep, String* res, char* errdtls)
 {
-	regmatch_t* match = NULL;
-	size_t subject_ro = 0;      // Running offset
-	int eflags = 0;
-	int err = 0;
-	int i, j;
+	Part parts[MAX_THREADS];
+	Bclass bc;
+	const char* nl;
+	size_t len = strlen(subject);
+	size_t held = 0;
+	size_t budget = SIZE_MAX;
+	size_t from;
+	size_t to;
+	size_t n;
+	size_t matc = 0;
+	size_t out = 0;
+	size_t execs = 0;
+	int bclass;
+	int err;
+	int i;
+
+	n = len / PART_MIN_SIZE;
+	if (n > rm->threads)
+		n = rm->threads;
+	if (n < 2 || len > REGOFF_MAX)
+		return PREG_NOACTION;
 
 	// Remove REG_NOSUB
 	if (REG_NOSUB&rm->cflags)
 		rm->cflags &= ~REG_NOSUB;
 
-	err = preg_checkopt(rm);
+	err = preg_comp(rm, pattern, rm->cflags);
 	if (err)
-		goto done;
+		return err;
+
+	// A match that contains a newline may span parts
+	if (!*pattern || rm->info.newline)
+		return PREG_NOACTION;
+
+	rm->matc = 0;
+	rm->start = 0;
+	rm->wide = 0;
+	rm->packed = 0;
+	rm->sel = 0;
+	sub_select(rm);
+	rm->sublen = len;
+	rm->step.subject = NULL;
+	bclass = bclass_compile(&bc, pattern, rm->cflags);
+
+	// The matches of the parts count against PREG_MAXMEM like the offsets
+	if (rm->maxmem)
+		budget = rm->maxmem > mem_used(rm) ? rm->maxmem -mem_used(rm) : 0;
+
+	memset(parts, 0, sizeof(parts));
+	for (i = 0, from = 0; i < n && from < len; ++i, from = to) {
+		to = i == n -1 ? len : len / n * (i +1);
+		if (to < from)
+			to = from;
+
+		// Parts end right after a newline
+		if (to < len) {
+			nl = memchr(&subject[to], '\n', len -to);
+			to = nl ? nl -subject +1 : len;
+		}
 
-	err = regcomp(&rm->comp, pattern, rm->cflags);
+		parts[i].rm      = rm;
+		parts[i].subject = subject;
+		parts[i].len     = len;
+		parts[i].from    = from;
+		parts[i].to      = to;
+		parts[i].rep     = rep;
+		parts[i].bc      = bclass ? &bc : NULL;
+		parts[i].held    = &held;
+		parts[i].budget  = budget;
+	}
+	n = i;
+
+	run_parts(parts, n, part_search);
+
+	for (i = 0; i < n; ++i) {
+		if (!err)
+			err = parts[i].err;
+		parts[i].index = matc;
+		parts[i].out   = out;
+		matc  += parts[i].matc;
+		out   += parts[i].outlen;
+		execs += parts[i].execs;
+	}
 	if (err)
-		goto done;
+		goto end;
 
-	rm->compd = 1;
+	if (rm->uflags & PREG_STATS) {
+		rm->stats.execs += execs;
+		rm->stats.bytes_scanned += len;
+		rm->stats.matches += matc;
+	}
+
+	if (!matc) {
+		err = REG_NOMATCH;
+		goto end;
+	}
+
+	// Check for invalid backreference numbers
+	for (i = 0; i < rm->bref.n; i++) {
+		if (rm->bref.entry[i].no > rm->subc) {
+			snprintf(errdtls, MAX_BREF_DIGITS +1, "%d", rm->bref.entry[i].no);
+			err = PREG_BADBREF;
+			goto end;
+		}
+	}
+
+	while (rm->offset_size < matc)
+		if ((err = preg_offset_alloc(rm)))
+			goto end;
+
+	if (mem_reserve(rm, out +1)) {
+		err = PREG_MEMLIMIT;
+		goto end;
+	}
+
+	res->str = mem_init(rm, out +1);
+	if (!res->str) {
+		err = PREG_MEMFAIL;
+		goto end;
+	}
+	res->len = out;
+
+	for (i = 0; i < n; ++i)
+		parts[i].res = res->str;
+
+	run_parts(parts, n, part_assemble);
+	res->str[out] = '\0';
+
+	rm->matc = matc;
+	rm->next.offset   = len;
+	rm->next.eflags   = REG_NOTBOL;
+	rm->next.index    = matc;
+	rm->next.done     = 1;
+	rm->next.adjacent = 0;
+
+end:
+	for (i = 0; i < n; ++i) {
+		preg_mfree(&rm->alloc, parts[i].found);
+		if (parts[i].compd)
+			regfree(&parts[i].comp);
+	}
+
+	return err;
+}
+
+/* Runs "fn" on each of the "n" parts, the first one on the calling thread.
+ * A part whose thread cannot be created also runs on the calling thread */
+static void run_parts(Part* parts, size_t n, void* (*fn)(void*))
+{
+	pthread_t tid[MAX_THREADS];
+	int started[MAX_THREADS];
+	int i;
+
+	for (i = 1; i < n; ++i) {
+		started[i] = !pthread_create(&tid[i], NULL, fn, &parts[i]);
+		if (!started[i])
+			fn(&parts[i]);
+	}
+
+	fn(&parts[0]);
+
+	for (i = 1; i < n; ++i)
+		if (started[i])
+			pthread_join(tid[i], NULL);
+}
+
+/* Finds the matches of a part like preg_offset() does in the whole subject */
+static void* part_search(void* arg)
+{
+	Part* pt = arg;
+	Preg* rm = pt->rm;
+	const regex_t* re = rm->re;
+	Preg_profile* prof = rm->uflags & PREG_PROFILE ? rm->prof : NULL;
+	const char* subject = pt->subject;
+	const char* so;
+	regmatch_t* match;
+	size_t nsub = rm->subc +1;
+	size_t ro = pt->from;
+	uint64_t start = 0;
+	int eflags;
+	int adjacent = 0;
+	int err;
+	int j;
+
+	pt->outlen = pt->to -pt->from;
+
+	if (pt->bc) {
+		while (ro < pt->to) {
+			so = bclass_find(pt->bc, &subject[ro], &subject[pt->to]);
+			if (so == &subject[pt->to])
+				break;
+			if ((pt->err = part_add(pt, &match)))
+				break;
+
+			ro = (pt->bc->plus ? bclass_span(pt->bc, so +1, &subject[pt->to])
+			                   : so +1) -subject;
+			match->rm_so = so -subject;
+			match->rm_eo = ro;
+			part_count(pt, match);
+		}
+		return NULL;
+	}
 
-	rm->subc = rm->comp.re_nsub;
-	match = malloc((rm->subc +1) * sizeof(*match));
-	if (!match) {
-		err = PREG_MEMFAIL;
-		goto done;
+	// Threads searching with the same compiled pattern may be serialized by
+	// regexec(), so every part but the first, which runs on the calling
+	// thread, is searched with its own copy
+	if (pt->from) {
+		if (prof)
+			start = preg_clock();
+		pt->err = regcomp(&pt->comp, rm->pat_sc.mem, rm->comp_cflags);
+		if (pt->err)
+			return NULL;
+		if (prof)
+			hist_add(&prof->compile_ns, preg_clock() -start);
+		pt->compd = 1;
+		re = &pt->comp;
 	}
 
-	// Find and discard matches until reaching the minimum accepted match
-	for (i = 0; i < rm->min && !(err = regexec(&rm->comp, &subject[subject_ro],
-	            rm->subc +1, match, eflags)); ++i) {
+	eflags = ro && !(rm->cflags & REG_NEWLINE) ? REG_NOTBOL : 0;
 
-		subject_ro += match->rm_eo;
+	for (;;) {
+		// regexec() cannot tell that the search starts at a line start
+		if ((rm->cflags & REG_NEWLINE) && ro && subject[ro -1] == '\n')
+			eflags &= ~REG_NOTBOL;
 
-		if (i == 0)
-			eflags |= REG_NOTBOL;
-	}
+		if ((pt->err = part_add(pt, &match)))
+			break;
+
+		// Like in preg_exec_re()
+		if (rm->deadline && preg_clock() >= rm->deadline) {
+			pt->err = PREG_TIMEDOUT;
+			break;
+		}
 
-	for (i = 0; !(err = regexec(&rm->comp, &subject[subject_ro], rm->subc +1,
-	            match, eflags)) && i < (unsigned)rm->limit; ++i) {
+		// The search stops at the end of the part
+		match->rm_so = 0;
+		match->rm_eo = pt->to -ro;
+		if (prof)
+			start = preg_clock();
+		err = regexec(re, &subject[ro], nsub, match, eflags | REG_STARTEND |
+		              (pt->to < pt->len ? REG_NOTEOL : 0));
+		pt->execs++;
+		if (prof) {
+			hist_add(&prof->exec_ns, preg_clock() -start);
+			hist_add(&prof->bytes, err ? pt->to -ro : match->rm_eo);
+		}
+		if (err) {
+			pt->err = err == REG_NOMATCH ? 0 : err;
+			break;
+		}
 
-		if (i == rm->offset_size) {
-			err = preg_offset_alloc(rm);
-			if (err)
-				goto done;
+		// Like in offset_exec(), skip an empty match where the previous
+		// match ended
+		if (adjacent && match->rm_eo == 0) {
+			if (ro >= pt->to)
+				break;
+			ro += char_len(&subject[ro]);
+			eflags |= REG_NOTBOL;
+			adjacent = 0;
+			continue;
 		}
 
-		for (j = 0; j <= rm->subc; j++) {
-			// Regexec returns -1 for subexpressions not matched
+		// An empty match at the end of the part belongs to the next one
+		if (ro +match->rm_so >= pt->to && pt->to < pt->len)
+			break;
+
+		sub_check(match, nsub);
+		for (j = 0; j < nsub; j++) {
 			if (match[j].rm_so != -1) {
-				rm->offset[i][j].rm_so = match[j].rm_so +subject_ro;
-				rm->offset[i][j].rm_eo = match[j].rm_eo +subject_ro;
-			}
-			else {
-				rm->offset[i][j].rm_so = -1;
-				rm->offset[i][j].rm_eo = -1;
+				match[j].rm_so += ro;
+				match[j].rm_eo += ro;
 			}
 		}
+		part_count(pt, match);
+
+		// Same as offset_advance()
+		ro = match->rm_eo;
+		eflags |= REG_NOTBOL;
+		adjacent = 1;
+		if (match->rm_eo == match->rm_so && ro < pt->len) {
+			ro += char_len(&subject[ro]);
+			adjacent = 0;
+		}
+	}
+	return NULL;
+}
 
-		subject_ro += match->rm_eo;
-		rm->matc++;
+/* Makes room for one more match in "pt" and points "match" to it. The match
+ * is kept only after part_count() */
+static int part_add(Part* pt, regmatch_t** match)
+{
+	size_t nsub = pt->rm->subc +1;
+	size_t size;
+	size_t grow;
+	size_t held;
+	regmatch_t* found;
+
+	if (pt->matc == pt->size) {
+		size = pt->size ? pt->size * MEM_GROWTH_FACTOR : 64;
+
+		// Charge the growth to the budget the parts share
+		if (pt->budget != SIZE_MAX) {
+			grow = (size -pt->size) * nsub * sizeof(regmatch_t);
+			held = ATOMIC_LOAD(pt->held);
+			do {
+				if (grow > pt->budget || held > pt->budget -grow)
+					return PREG_MEMLIMIT;
+			} while (!ATOMIC_CAS(pt->held, &held, held +grow));
+		}
 
-		if (i == 0)
-			eflags |= REG_NOTBOL;
+		found = preg_realloc(&pt->rm->alloc, pt->found,
+		                     size * nsub * sizeof(regmatch_t));
+		if (!found)
+			return PREG_MEMFAIL;
 
-		/* Sometimes the empty pattern may successfully match zero characters.
-		 * But there is nothing more to be done so we break */
-		if (*pattern == '\0')
-			break;
+		pt->found = found;
+		pt->size  = size;
 	}
-	if (err == REG_NOMATCH && i > 0)
-		err = 0;
-
-done:
-	free(match);
+	*match = &pt->found[pt->matc * nsub];
 
-	return err;
+	return 0;
 }
 
-int preg_offset_alloc(Preg* rm)
+/* Keeps "match" and adds the length of its replacement to the output of
+ * "pt", like assemble() does */
+static void part_count(Part* pt, const regmatch_t* match)
 {
-	regmatch_t** offset;
-	void* mem;
-	size_t old_size;
-	size_t new_size;
-	size_t offs_elem_size = (rm->subc +1) * sizeof(regmatch_t);
+	const bref_vec* bref = &pt->rm->bref;
+	const regmatch_t* sub;
 	int i;
 
-	old_size = rm->offset_size;
-	new_size = old_size ? old_size * MEM_GROWTH_FACTOR : 1;
+	pt->outlen += pt->rep->len;
+	pt->outlen -= match->rm_eo -match->rm_so;
 
-    offset = realloc(rm->offset, new_size * sizeof(regmatch_t*));
-    if (!offset)
-	    return PREG_MEMFAIL;
+	for (i = 0; i < bref->n; i++) {
+		// Invalid backreferences are reported once the search is over
+		if (bref->entry[i].no > pt->rm->subc)
+			continue;
 
-    mem = mem_init(rm, (new_size -old_size) * offs_elem_size);
-    if (!mem)
-	    return PREG_MEMFAIL;
+		sub = &match[bref->entry[i].no];
+		if (sub->rm_so != -1)
+			pt->outlen += sub->rm_eo -sub->rm_so;
+	}
 
-	for (i = old_size; i < new_size; ++i)
-		offset[i] = mem_alloc(&mem, offs_elem_size);
+	pt->matc++;
+}
 
-	rm->offset = offset;
-	rm->offset_size = new_size;
+/* Copies the output of a part to its place in the result, like assemble() and
+ * copy_rep() do, and its matches to the offset matrix */
+static void* part_assemble(void* arg)
+{
+	Part* pt = arg;
+	Preg* rm = pt->rm;
+	const bref_vec* bref = &rm->bref;
+	const String* rep = pt->rep;
+	const regmatch_t* match;
+	const regmatch_t* sub;
+	char* mem = pt->res +pt->out;
+	size_t nsub = rm->subc +1;
+	size_t ro = pt->from;
+	size_t rep_ro;
+	size_t k;
+	int i;
 
-    return 0;
+	for (k = 0; k < pt->matc; k++) {
+		match = &pt->found[k * nsub];
+
+		memcpy(mem, &pt->subject[ro], match->rm_so -ro);
+		mem += match->rm_so -ro;
+		ro   = match->rm_eo;
+
+		rep_ro = 0;
+		for (i = 0; i < bref->n; i++) {
+			memcpy(mem, &rep->str[rep_ro], bref->entry[i].so -rep_ro);
+			mem   += bref->entry[i].so -rep_ro;
+			rep_ro = bref->entry[i].so;
+
+			sub = &match[bref->entry[i].no];
+			if (sub->rm_so != -1) {
+				memcpy(mem, &pt->subject[sub->rm_so], sub->rm_eo -sub->rm_so);
+				mem += sub->rm_eo -sub->rm_so;
+			}
+		}
+		memcpy(mem, &rep->str[rep_ro], rep->len -rep_ro);
+		mem += rep->len -rep_ro;
+
+		memcpy(rm->offset[pt->index +k], match, nsub * sizeof(regmatch_t));
+	}
+	memcpy(mem, &pt->subject[ro], pt->to -ro);
+
+	return NULL;
 }
+#endif
+/* The output buffer of preg_replace_cb(). It is backed by the "out_sc" scratch
+ * memory of the handle */
+struct Preg_buf {
+	Preg* rm;
+	size_t len;             // Length of the output so far
+	int err;                // The first error of preg_bufcat()
+};
 
-/* Performs a regex match on a given string and stores the resulting strings.
- *
- * Parameters:
- * Preg* rm:			A Preg structure where the results will be saved
- * const char* subject: The string on which the regex search is performed
- * const char* pattern:	The regex pattern
- *
- * On success it returns 0. Else it returns an error code.
- */
-int preg_match(Preg* rm, const char* subject, const char* pattern)
+/* Makes room for "len" more bytes and a terminating null byte in "buf" */
+static int buf_reserve(Preg_buf* buf, size_t len)
 {
-	Preg_sub* match = NULL;
-	size_t memsize = 0;
-	size_t match_size;
-	size_t sub_size;
-	void* mem;
+	Preg* rm = buf->rm;
+	size_t size = buf->len +len +1;
 	int err;
-	int i, j;
 
-	preg_set_mode(rm, PREG_MATCH);
+	if (size <= rm->out_sc.size)
+		return 0;
 
-	if ((err = preg_offset(rm, subject, pattern)))
-		goto end;
+	if ((err = mem_reserve(rm, size -rm->out_sc.size)))
+		return err;
 
-	// Does the user want the matched strings?
-	if (rm->uflags & PREG_NOSTRINGS)
-		goto end;
+	if (!scratch_get(rm, &rm->out_sc, size))
+		return PREG_MEMFAIL;
 
-	// Calculate the size of the relevant structures
-	match_size = preg_matc(rm) * sizeof(Preg_sub);
-	sub_size  = (preg_subc(rm) +1) * sizeof(char*);
+	return 0;
+}
 
-	memsize += match_size;
-	memsize += preg_matc(rm) * sub_size;
+int preg_bufcat(Preg_buf* buf, const char* str, size_t len)
+{
+	if (!buf->err)
+		buf->err = buf_reserve(buf, len);
+	if (buf->err)
+		return buf->err;
 
-	// Calculate the total length of the matched strings
-	for (i = 0; i < preg_matc(rm); ++i)
-		for (j = 0; j <= preg_subc(rm); ++j)
-			memsize += preg_matchlen(rm, i, j) +1;
+	memcpy((char*)buf->rm->out_sc.mem +buf->len, str, len);
+	buf->len += len;
 
-	// One-time allocation
-	if ((mem = mem_init(rm, memsize)) == NULL) {
-		err = PREG_MEMFAIL;
+	return 0;
+}
+
+/* Like preg_replace(), but the replacement of every match is written by "cb".
+ * The output is assembled in a single pass, without copying the matches */
+int preg_replace_cb(Preg* rm, const char* subject, const char* pattern,
+                    Preg_replace_cb cb, void* ctx)
+{
+	Preg_buf buf = { rm, 0, 0 };
+	const regmatch_t* row;
+	size_t sublen;
+	size_t ro = 0;
+	size_t base;
+	int err;
+	size_t i;
+
+	if ((err = preg_offset(rm, subject, pattern, 0)))
 		goto end;
-	}
 
-	match = mem_alloc(&mem, match_size);
+	sublen = strlen(subject);
 
-	// Copy the matched strings to the appropriate structures
-	for (i = 0; i < preg_matc(rm); ++i) {
-		match[i].sub = mem_alloc(&mem, sub_size);
+	// The output is at least as long as the unmatched parts of the subject
+	if ((err = buf_reserve(&buf, sublen)))
+		goto end;
 
-		for (j = 0; j <= preg_subc(rm); ++j) {
-			size_t len = preg_matchlen(rm, i, j);
+	for (i = 0; i < preg_matc(rm); i++) {
+		err = preg_bufcat(&buf, &subject[ro], preg_start(rm, i, 0) -ro);
+		if (err)
+			goto end;
+		ro = preg_end(rm, i, 0);
 
-			match[i].sub[j] = mem_alloc(&mem, len +1);
+		// The offsets of a wide subject count from the base of their match
+		if (!(row = offset_row(rm, i, &base))) {
+			err = PREG_MEMFAIL;
+			goto end;
+		}
 
-			memcpy(match[i].sub[j], &subject[preg_so(rm, i, j)], len);
-			match[i].sub[j][len] = '\0';
+		if (cb(&buf, &subject[base], row, rm->subc +1, ctx)) {
+			err = buf.err ? buf.err : PREG_CBABORT;
+			goto end;
 		}
 	}
 
+	if ((err = preg_bufcat(&buf, &subject[ro], sublen -ro)))
+		goto end;
+	((char*)rm->out_sc.mem)[buf.len] = '\0';
+
+	preg_set_mode(rm, PREG_REPLACE);
+
+	rm->rep.str = rm->out_sc.mem;
+	rm->rep.len = buf.len;
+
 end:
-	rm->matches.match = match;
 	err = preg_set_error(rm, err);
 
 	return err;
 }
 
-int preg_split(Preg* rm, const char* subject, const char* pattern)
+/* Appends a rule to the rules of preg_replace_rules(). "pattern" is compiled
+ * with the current PREG_CFLAGS of the handle */
+int preg_addrule(Preg* rm, const char* pattern, const char* rep)
 {
-	void* mem;
-	String* split = NULL;
-	size_t split_size = 0;
-	size_t prev_eo;
-	size_t len;
-	size_t len_total = 0;
+	Rule* rule;
+	char errdtls[MAX_BREF_DIGITS +1] = "";
+	int cflags = rm->cflags & ~REG_NOSUB;
+	uint64_t start = 0;
 	int err;
 	int i;
 
-	preg_set_mode(rm, PREG_SPLIT);
+	rule = preg_malloc(&rm->alloc, sizeof(Rule) +strlen(rep) +1);
+	if (!rule)
+		return preg_set_error(rm, PREG_MEMFAIL);
 
-	if ((err = preg_offset(rm, subject, pattern)))
-		goto end;
+	rule->rep.str = (char*)(rule +1);
+	rule->cflags  = cflags;
+	rule->bref    = bref_vec_init_auto(&rm->alloc);
+	rule->match   = NULL;
+	rule->prof    = NULL;
 
-	// Allocate the max size needed for all the split string segments
-	split = mem_init(rm, (preg_matc(rm) +1) * sizeof(String));
-	if (!split) {
+	if (rm->uflags & PREG_PROFILE)
+		start = preg_clock();
+
+	if ((err = regcomp(&rule->comp, pattern, cflags))) {
+		bref_vec_free_auto(&rule->bref, NULL);
+		preg_mfree(&rm->alloc, rule);
+		return preg_set_error(rm, err);
+	}
+	rule->subc = rule->comp.re_nsub;
+	rule->bclass = bclass_compile(&rule->bc, pattern, cflags);
+
+	if (rm->uflags & PREG_PROFILE) {
+		if (!(rule->prof = profile_get(rm, pattern, cflags))) {
+			err = PREG_MEMFAIL;
+			goto fail;
+		}
+		hist_add(&rule->prof->compile_ns, preg_clock() -start);
+	}
+
+	if ((err = parse_rep(rep, &rule->rep, &rule->bref)))
+		goto fail;
+
+	for (i = 0; i < rule->bref.n; i++) {
+		if (rule->bref.entry[i].no > rule->subc) {
+			snprintf(errdtls, MAX_BREF_DIGITS +1, "%d", rule->bref.entry[i].no);
+			err = PREG_BADBREF;
+			goto fail;
+		}
+	}
+
+	rule->match = preg_malloc(&rm->alloc, (rule->subc +1) * sizeof(regmatch_t));
+	if (!rule->match || pvoid_vec_append(&rm->rules, rule)) {
 		err = PREG_MEMFAIL;
-		goto end;
+		goto fail;
 	}
 
-	// Calculate the total size needed for all the split segments. Store their
-	// lengths and start pointers
-	prev_eo = 0;
-	for (i = 0; i <= preg_matc(rm); ++i) {
-		if (i == preg_matc(rm))
-			len = strlen(&subject[prev_eo]);
-		else
-			len = preg_so(rm, i, 0) -prev_eo;
+	return preg_set_error(rm, 0);
 
-		if (len) {
-			split[split_size].str = (char*)&subject[prev_eo];
-			split[split_size].len = len;
+fail:
+	rule_free(rm, rule);
 
-			len_total += len +1;
+	return preg_set_error(rm, err, errdtls);
+}
 
-			split_size++;
+void preg_clearrules(Preg* rm)
+{
+	int i;
+
+	for (i = 0; i < rm->rules.n; ++i)
+		rule_free(rm, rm->rules.entry[i]);
+	rm->rules.n = 0;
+}
+
+static void rule_free(Preg* rm, Rule* rule)
+{
+	regfree(&rule->comp);
+	bref_vec_free_auto(&rule->bref, NULL);
+	preg_mfree(&rm->alloc, rule->match);
+	preg_mfree(&rm->alloc, rule);
+}
+
+/* Searches "subject" of length "len" for the next match of "rule" from "ro" */
+static int rule_exec(Preg* rm, Rule* rule, const char* subject, size_t ro,
+                     size_t len)
+{
+	const char* end = subject +len;
+	const char* so;
+	int eflags;
+	int err;
+	int j;
+
+	if (rule->bclass) {
+		so = bclass_find(&rule->bc, &subject[ro], end);
+		if (so == end) {
+			rule->found = -1;
+			return 0;
 		}
 
-		if (i != preg_matc(rm))
-			prev_eo = preg_eo(rm, i, 0);
-	}
+		rule->match[0].rm_so = so -subject;
+		rule->match[0].rm_eo = (rule->bc.plus ? bclass_span(&rule->bc, so +1,
+		                        end) : so +1) -subject;
+		rule->found = 1;
 
-	// One time allocation
-	if ((mem = mem_init(rm, len_total)) == NULL) {
-		err = PREG_MEMFAIL;
-		goto end;
+		return 0;
 	}
 
-	// Iterate a second time over the results and store the resulting strings
-	for (i = 0; i < split_size; ++i) {
-		void* temp = split[i].str;
+	// regexec() cannot tell that the search starts at a line start
+	eflags = ro ? REG_NOTBOL : 0;
+	if ((rule->cflags & REG_NEWLINE) && ro && subject[ro -1] == '\n')
+		eflags = 0;
+
+#ifdef REG_STARTEND
+	// The bounds spare regexec() measuring the rest of the subject at every
+	// search
+	rule->match[0].rm_so = 0;
+	rule->match[0].rm_eo = len -ro;
+	eflags |= REG_STARTEND;
+#endif
+
+	err = preg_exec_re(rm, &rule->comp, rule->prof, rule->subc +1,
+	                   &subject[ro], rule->match, eflags);
+	if (err == REG_NOMATCH) {
+		rule->found = -1;
+		return 0;
+	}
+	else if (err)
+		return err;
 
-		split[i].str = mem_alloc(&mem, split[i].len +1);
-		memcpy(split[i].str, temp, split[i].len);
-		split[i].str[split[i].len] = '\0';
+	for (j = 0; j <= rule->subc; j++) {
+		if (rule->match[j].rm_so != -1) {
+			rule->match[j].rm_so += ro;
+			rule->match[j].rm_eo += ro;
+		}
 	}
+	rule->found = 1;
 
-end:
-	rm->splits.split = split;
-	rm->splits.size = split_size;
+	return 0;
+}
 
-	err = preg_set_error(rm, err);
-	return err;
+/* Writes the replacement string of "rule" to "buf", after applying the
+ * backreferences to its current match */
+static int rule_copy(Preg_buf* buf, const char* subject, const Rule* rule)
+{
+	const regmatch_t* sub;
+	size_t ro = 0;
+	int err;
+	int i;
+
+	for (i = 0; i < rule->bref.n; i++) {
+		err = preg_bufcat(buf, &rule->rep.str[ro], rule->bref.entry[i].so -ro);
+		if (err)
+			return err;
+		ro = rule->bref.entry[i].so;
+
+		sub = &rule->match[rule->bref.entry[i].no];
+		if (sub->rm_so != -1 && (err = preg_bufcat(buf, &subject[sub->rm_so],
+		                                           sub->rm_eo -sub->rm_so)))
+			return err;
+	}
+
+	return preg_bufcat(buf, &rule->rep.str[ro], rule->rep.len -ro);
 }
 
-int preg_replace(Preg* rm, const char* subject, const char* pattern,
-				 const char* rep)
+/* Applies all the rules added with preg_addrule() in a single scan of
+ * "subject". At every position the rule that matches earliest wins, and
+ * among rules matching at the same position the one added first. The scan
+ * resumes after the winning match. A rule is searched again only when its
+ * next match was overtaken by the scan */
+int preg_replace_rules(Preg* rm, const char* subject)
 {
-	String res;
-	String nrep;
-	bref_vec bref;
-	char errdtls[MAX_BREF_DIGITS +1] = "";
-	int err = 0;
+	Preg_buf buf = { rm, 0, 0 };
+	Rule* rule;
+	Rule* best;
+	size_t len;
+	size_t pos = 0;     // Where the scan continues
+	size_t ro = 0;      // The part of "subject" not copied to "buf" yet
+	size_t last = -1;   // End of the last non-empty match
+	size_t so, eo;
+	int skipped = 0;
+	int replaced = 0;
+	int err;
 	int i;
 
-	bref = bref_vec_init_auto();
-	nrep.str = malloc(strlen(rep) +1);
-	if (!nrep.str) {
-		err = PREG_MEMFAIL;
+	timeout_start(rm);
+	mem_reset(rm);
+	rm->matc = 0;
+	rm->step.subject = NULL;
+
+	if ((err = preg_checkopt(rm)))
+		goto end;
+
+	len = strlen(subject);
+
+	// The matches of the rules are kept as regoff_t offsets
+	if (len > REGOFF_MAX) {
+		err = PREG_TOOLARGE;
 		goto end;
 	}
 
-	if ((err = parse_rep(rep, &nrep, &bref)))
+	if ((err = buf_reserve(&buf, len)))
 		goto end;
 
-	// If the replacement string includes backreferences
-	if (bref.n > 0) {
+	for (i = 0; i < rm->rules.n; ++i)
+		((Rule*)rm->rules.entry[i])->found = 0;
 
-		// PREG_NOSTRINGS will cause conflicts here
-		if (rm->uflags & PREG_NOSTRINGS)
-			rm->uflags &= ~PREG_NOSTRINGS;
+	while (pos <= len && replaced < (unsigned)rm->limit) {
+		best = NULL;
+		for (i = 0; i < rm->rules.n; ++i) {
+			rule = rm->rules.entry[i];
 
-		// We need the matched strings for applying them to the backreferences
-		// in the replacement string
-		if ((err = preg_match(rm, subject, pattern)))
-			goto end;
+			if (rule->found == 0 ||
+			   (rule->found == 1 && rule->match[0].rm_so < pos))
+				if ((err = rule_exec(rm, rule, subject, pos, len)))
+					goto end;
 
-		// Check for invalid backreference numbers
-		for (i = 0; i < bref.n; i++) {
-			if (bref.entry[i].no > preg_subc(rm)) {
-				snprintf(errdtls, MAX_BREF_DIGITS +1, "%d", bref.entry[i].no);
-				err = PREG_BADBREF;
+			if (rule->found == 1 &&
+			   (!best || rule->match[0].rm_so < best->match[0].rm_so))
+				best = rule;
+		}
+
+		if (!best)
+			break;
+
+		so = best->match[0].rm_so;
+		eo = best->match[0].rm_eo;
+
+		// An empty match where the previous match ended is not accepted, as
+		// in preg_offset()
+		if (so == eo && so == last) {
+			pos = so +char_len(&subject[so]);
+			continue;
+		}
+
+		if (skipped < rm->min)
+			skipped++;
+		else {
+			rm->stats.matches += rm->uflags & PREG_STATS ? 1 : 0;
+			if ((err = preg_bufcat(&buf, &subject[ro], so -ro)))
 				goto end;
-			}
+			if ((err = rule_copy(&buf, subject, best)))
+				goto end;
+			ro = eo;
+			replaced++;
 		}
+
+		// An empty match shall not stop the scan
+		if (eo > so)
+			pos = last = eo;
+		else
+			pos = eo +(eo < len ? char_len(&subject[eo]) : 1);
 	}
-	else
-		if ((err = preg_offset(rm, subject, pattern)))
-			goto end;
 
-	res = assemble(rm, subject, &nrep, &bref);
-	if (res.str == NULL) {
-		err = PREG_MEMFAIL;
+	if (!replaced) {
+		err = REG_NOMATCH;
 		goto end;
 	}
 
+	if ((err = preg_bufcat(&buf, &subject[ro], len -ro)))
+		goto end;
+	((char*)rm->out_sc.mem)[buf.len] = '\0';
+
+	rm->stats.bytes_scanned += rm->uflags & PREG_STATS ? len : 0;
+
 	preg_set_mode(rm, PREG_REPLACE);
 
-	rm->rep = res;
+	rm->rep.str = rm->out_sc.mem;
+	rm->rep.len = buf.len;
 
 end:
-	free(nrep.str);
-	bref_vec_free_auto(&bref, NULL);
-
-	err = preg_set_error(rm, err, errdtls);
+	err = preg_set_error(rm, err);
 
 	return err;
 }
@@ -816,16 +4739,16 @@ static int parse_rep(const char* rep, String* nrep, bref_vec* brvec)
 	return 0;
 }
 
-static String
-assemble(Preg* rm, const char* subject, String* rep, bref_vec* bref)
+static int assemble(Preg* rm, const char* subject, String* rep,
+                    bref_vec* bref, String* res)
 {
-	String res;
 	void*  mem;
 	size_t len;
 	size_t len_total = 0;
 	size_t ro = 0;
 	size_t sublen;
-	int i, j;
+	size_t i;
+	int j;
 
 	sublen = strlen(subject);
 
@@ -835,30 +4758,31 @@ assemble(Preg* rm, const char* subject, String* rep, bref_vec* bref)
 	for (i = 0; i < preg_matc(rm); i++) {
 		// Add the lengths of all the backreferences
 		for (j = 0; j < bref->n; j++)
-			len_total += preg_matchlen(rm, i, bref->entry[j].no);
+			len_total += sub_len(rm, i, bref->entry[j].no);
 
 		// Remove the length of the strings that will be replaced
-		len_total -= preg_matchlen(rm, i, 0);
+		len_total -= sub_len(rm, i, 0);
 	}
 
-	res.str = mem = mem_init(rm, len_total +1);
-	if (!mem) {
-		res.len = -1;
-		return res;
-	}
-	res.len = len_total;
+	if (mem_reserve(rm, len_total +1))
+		return PREG_MEMLIMIT;
+
+	res->str = mem = mem_init(rm, len_total +1);
+	if (!mem)
+		return PREG_MEMFAIL;
+	res->len = len_total;
 
 	for (i = 0; i < preg_matc(rm); i++) {
-		memcpy(mem, &subject[ro], preg_so(rm, i, 0) -ro);
-		mem += preg_so(rm, i, 0) -ro;
-		ro   = preg_eo(rm, i, 0);
+		memcpy(mem, &subject[ro], preg_start(rm, i, 0) -ro);
+		mem += preg_start(rm, i, 0) -ro;
+		ro   = preg_end(rm, i, 0);
 
 		len = copy_rep(rm, i, rep, bref, mem);
 		mem += len;
 	}
 	memcpy(mem, &subject[ro], sublen -ro +1);
 
-	return res;
+	return 0;
 }
 
 /* Copy the replacement string to "mem" and after applying any specified
@@ -867,8 +4791,8 @@ assemble(Preg* rm, const char* subject, String* rep, bref_vec* bref)
  * Return value:
  * The length of the constructed replacement string
  * */
-static int
-copy_rep(Preg* rm, int nmatch, String* rep, bref_vec* bref, void* mem)
+static size_t
+copy_rep(Preg* rm, size_t nmatch, String* rep, bref_vec* bref, void* mem)
 {
 	const void* const mem_start = mem;
 	size_t ro = 0; // "rep's" reading offset
@@ -883,8 +4807,8 @@ copy_rep(Preg* rm, int nmatch, String* rep, bref_vec* bref, void* mem)
 			mem += bref->entry[i].so -ro;
 			ro   = bref->entry[i].so;
 
-			len = preg_matchlen(rm, nmatch, bref->entry[i].no);
-			memcpy(mem, preg_getmatch(rm, nmatch, bref->entry[i].no), len);
+			len = sub_len(rm, nmatch, bref->entry[i].no);
+			memcpy(mem, rm->matches.match[nmatch].sub[bref->entry[i].no], len);
 			mem += len;
 		}
 		memcpy(mem, &rep->str[ro], rep->len -ro);
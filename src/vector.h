@@ -26,6 +26,15 @@
 
 #define VECTOR_GROWTH_FACTOR 2
 
+/* The allocation functions may be overridden by defining the following macros
+ * before including this file. "ctx" is the context passed to the _init
+ * functions and stored in the vector */
+#ifndef VECTOR_MALLOC
+#define VECTOR_MALLOC(ctx, size)       malloc(size)
+#define VECTOR_REALLOC(ctx, ptr, size) realloc(ptr, size)
+#define VECTOR_FREE(ctx, ptr)          free(ptr)
+#endif
+
 /* The following definition, which replaces a function macro with a similar
  * function macro is done to prevent token pasting of the macro arguments
  * without expanding them first */
@@ -35,11 +44,12 @@
 		Entry_t* entry;                                                        \
 		size_t n;                                                              \
 		size_t size;                                                           \
+		void* ctx;                                                             \
 	} Vector_t;                                                                \
                                                                                \
-	Vector_t Vector_t##_init_auto(void);                                       \
+	Vector_t Vector_t##_init_auto(void* ctx);                                  \
 	void Vector_t##_free_auto(Vector_t* v, void (*free_entry)(Entry_t));       \
-	Vector_t* Vector_t##_init(void);                                           \
+	Vector_t* Vector_t##_init(void* ctx);                                      \
 	void Vector_t##_free(Vector_t* v, void (*free_entry)(Entry_t));            \
 	int Vector_t##_append(Vector_t* v, Entry_t entry);                         \
 
@@ -48,20 +58,20 @@
                                                                                \
 static Entry_t* Vector_t##_resize(Vector_t* v, size_t new_size);               \
                                                                                \
-Vector_t Vector_t##_init_auto(void)                                            \
+Vector_t Vector_t##_init_auto(void* ctx)                                       \
 {                                                                              \
-	Vector_t v = { NULL, 0, 0 };                                               \
+	Vector_t v = { NULL, 0, 0, ctx };                                          \
 	return v;                                                                  \
 }                                                                              \
                                                                                \
-Vector_t* Vector_t##_init(void)                                                \
+Vector_t* Vector_t##_init(void* ctx)                                           \
 {                                                                              \
-	Vector_t* v = malloc(sizeof(*v));                                          \
+	Vector_t* v = VECTOR_MALLOC(ctx, sizeof(*v));                              \
                                                                                \
 	if (!v)                                                                    \
 		return NULL;                                                           \
                                                                                \
-	*v = Vector_t##_init_auto();                                               \
+	*v = Vector_t##_init_auto(ctx);                                            \
                                                                                \
 	return v;                                                                  \
 }                                                                              \
@@ -75,7 +85,7 @@ void Vector_t##_free_auto(Vector_t* v, void (*free_entry)(Entry_t))            \
 			for (i = 0; i < v->n; ++i)                                         \
 				free_entry(v->entry[i]);                                       \
                                                                                \
-		free(v->entry);                                                        \
+		VECTOR_FREE(v->ctx, v->entry);                                         \
 	}                                                                          \
 }                                                                              \
                                                                                \
@@ -83,13 +93,13 @@ void Vector_t##_free(Vector_t* v, void (*free_entry)(Entry_t))                 \
 {                                                                              \
 	if (v) {                                                                   \
 		Vector_t##_free_auto(v, free_entry);                                   \
-		free(v);                                                               \
+		VECTOR_FREE(v->ctx, v);                                                \
 	}                                                                          \
 }                                                                              \
                                                                                \
 static Entry_t* Vector_t##_resize(Vector_t* v, size_t new_size)                \
 {                                                                              \
-	void* tmp = realloc(v->entry, new_size * sizeof(Entry_t));                 \
+	void* tmp = VECTOR_REALLOC(v->ctx, v->entry, new_size * sizeof(Entry_t));  \
 	if (!tmp)                                                                  \
 		return NULL;                                                           \
                                                                                \
@@ -0,0 +1,123 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* A warmed-up handle shall serve repeated operations on similar subjects
+ * without any heap allocation. The allocations are counted by interposing
+ * the allocator of the C library.
+ *
+ * The system regexec() may allocate by itself for patterns with
+ * subexpressions, so the patterns here have none */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <regutils.h>
+#include "check.h"
+
+static size_t allocs;
+
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static const char* const subjects[] = {
+	"GET /index.html ms=12 status=200 bytes=5120",
+	"POST /api/login ms=340 status=401 bytes=87",
+	"GET /img/logo.png ms=3 status=304 bytes=0"
+};
+
+#define SUBJECTC (sizeof(subjects) / sizeof(subjects[0]))
+
+/* Runs every operation on every subject, each operation on a handle of its
+ * own, and returns the allocations made. A handle only keeps the last pattern
+ * it compiled, so one alternating between patterns would recompile them */
+static size_t run(Preg** rm)
+{
+	size_t start = allocs;
+	size_t i;
+
+	for (i = 0; i < SUBJECTC; ++i) {
+		CHECK(!preg_match(rm[0], subjects[i], "ms=[0-9]+"));
+		CHECK(preg_matc(rm[0]) == 1);
+		CHECK(!preg_replace(rm[1], subjects[i], "ms=[0-9]+", "ms=0"));
+		CHECK(!preg_replace(rm[2], subjects[i], "[a-z]+=", "<$0>"));
+		CHECK(!preg_split(rm[3], subjects[i], " "));
+		CHECK(preg_splitc(rm[3]) == 5);
+		CHECK(!preg_grep(rm[4], subjects[i], "status=[0-9]+"));
+	}
+
+	return allocs -start;
+}
+
+int main(void)
+{
+	Preg* rm[5];
+	size_t i;
+	int j;
+
+#ifndef __GLIBC__
+	return SKIP;
+#endif
+
+	for (i = 0; i < 5; ++i)
+		if (!(rm[i] = preg_init()))
+			return EXIT_FAILURE;
+
+	/* Warm up. Every handle performs more than one operation, so that the
+	 * results that overflowed its arena are merged into a single block */
+	run(rm);
+	CHECK(allocs > 0);
+
+	for (j = 0; j < 10; ++j)
+		CHECK(run(rm) == 0);
+
+	// Likewise with strings left out
+	for (i = 0; i < 5; ++i)
+		preg_setopt(rm[i], PREG_UFLAGS, PREG_NOSTRINGS);
+	run(rm);
+	for (j = 0; j < 10; ++j)
+		CHECK(run(rm) == 0);
+
+	for (i = 0; i < 5; ++i)
+		preg_free(rm[i]);
+
+	return failures;
+}
@@ -0,0 +1,233 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* The match loop skips the parts of the subject where the properties of the
+ * pattern rule out a match: a rest shorter than the shortest match, and the
+ * text between line starts for a pattern anchored with "^". Its results
+ * shall be those of the plain loop, which tries regexec() at every offset
+ * it reaches. The plain loop here follows the rules of the library: an
+ * empty match where the previous match ended is not accepted, and "^" only
+ * matches after a newline with REG_NEWLINE. preg_rematch() relies on the
+ * longest match and on whether a match may be empty, and is held to the
+ * plain loop too */
+
+#include <stdlib.h>
+#include <string.h>
+#include <regex.h>
+#include <regutils.h>
+#include "check.h"
+
+#define ROUNDS  300
+#define MAXLEN  14
+#define MAXMATC (MAXLEN +2)
+
+static const char* patterns[] = {
+	"^a",                   // Anchored
+	"^",
+	"^$",
+	"^a|^b",
+	"^(ab|b)+",
+	"(^a|b)",               // Not every match is anchored
+	"abab",                 // Longer than many subjects
+	"a,b,a",
+	"[ab]{3,4}",
+	"ba?b",
+	"[ab]$",                // Bounded, and depends on the byte after
+	"x*",                   // Empty matches
+	"a*",
+	"b?",
+	"(a|)",
+	"a*$",
+	"^b*",
+	",|$",
+	"\n"
+};
+
+#define PATTERNC (sizeof(patterns) / sizeof(patterns[0]))
+
+static unsigned int seed = 1;
+
+static unsigned int next(unsigned int n)
+{
+	seed = seed * 1103515245 +12345;
+
+	return (seed >> 16) % n;
+}
+
+static void fill(char* str, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		str[i] = "ab,\n"[next(4)];
+	str[len] = '\0';
+}
+
+/* Finds the matches of "re" in "s" at every offset and returns their number */
+static size_t plain(const regex_t* re, int cflags, const char* s,
+                    regmatch_t* found)
+{
+	regmatch_t match;
+	size_t ro = 0;
+	size_t n = 0;
+	int eflags = 0;
+	int adjacent = 0;
+
+	while (n < MAXMATC) {
+		if ((cflags & REG_NEWLINE) && ro && s[ro -1] == '\n')
+			eflags &= ~REG_NOTBOL;
+		if (regexec(re, &s[ro], 1, &match, eflags))
+			break;
+
+		if (adjacent && match.rm_eo == 0) {
+			if (!s[ro])
+				break;
+			ro++;
+			eflags |= REG_NOTBOL;
+			adjacent = 0;
+			continue;
+		}
+
+		found[n].rm_so = ro +match.rm_so;
+		found[n].rm_eo = ro +match.rm_eo;
+		n++;
+
+		ro += match.rm_eo;
+		eflags |= REG_NOTBOL;
+		adjacent = 1;
+		if (match.rm_so == match.rm_eo && s[ro]) {
+			ro++;
+			adjacent = 0;
+		}
+	}
+
+	return n;
+}
+
+/* Builds the result of replacing the matches "found" of "s" with "<$0>" */
+static void plain_replace(const char* s, const regmatch_t* found, size_t n,
+                          char* res)
+{
+	size_t ro = 0;
+	size_t i;
+
+	*res = '\0';
+	for (i = 0; i < n; ++i) {
+		strncat(res, &s[ro], found[i].rm_so -ro);
+		strcat(res, "<");
+		strncat(res, &s[found[i].rm_so], found[i].rm_eo -found[i].rm_so);
+		strcat(res, ">");
+		ro = found[i].rm_eo;
+	}
+	strcat(res, &s[ro]);
+}
+
+/* Compares the results of "rm" with the matches "found" */
+static int same(Preg* rm, const regmatch_t* found, size_t n)
+{
+	size_t i;
+
+	if (preg_errcode(rm) != (n ? 0 : REG_NOMATCH) || preg_matc(rm) != n)
+		return 0;
+
+	for (i = 0; i < n; ++i)
+		if (preg_so(rm, i, 0) != found[i].rm_so ||
+		    preg_eo(rm, i, 0) != found[i].rm_eo)
+			return 0;
+
+	return 1;
+}
+
+static void check(Preg* rm, const regex_t* re, int cflags, const char* pattern,
+                  const char* s)
+{
+	regmatch_t found[MAXMATC];
+	char res[3 * MAXMATC +MAXLEN +1];
+	char edit[MAXLEN +1];
+	size_t n = plain(re, cflags, s, found);
+	size_t at;
+	int ok;
+
+	preg_match(rm, s, pattern);
+	ok = same(rm, found, n);
+
+	plain_replace(s, found, n, res);
+	if (ok && n)
+		ok = !preg_replace(rm, s, pattern, "<$0>") &&
+		     !strcmp(preg_getrep(rm), res);
+
+	// One byte replaced after a full match
+	if (ok && *s) {
+		strcpy(edit, s);
+		at = next(strlen(s));
+		edit[at] = "ab,\n"[next(4)];
+		n = plain(re, cflags, edit, found);
+		preg_match(rm, s, pattern);
+		preg_rematch(rm, edit, pattern, at, 1, 1);
+		ok = same(rm, found, n);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "pattern \"%s\"%s, subject \"%s\"\n", pattern,
+		        cflags & REG_NEWLINE ? " with REG_NEWLINE" : "", s);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	static const int cflags[] = { REG_EXTENDED, REG_EXTENDED | REG_NEWLINE };
+	Preg* rm;
+	regex_t re;
+	char s[MAXLEN +1];
+	size_t i, n;
+	int c;
+
+	rm = preg_init();
+	if (!rm)
+		return EXIT_FAILURE;
+
+	for (c = 0; c < 2; ++c) {
+		preg_delopt(rm, PREG_CFLAGS, REG_NEWLINE);
+		preg_setopt(rm, PREG_CFLAGS, cflags[c]);
+
+		for (n = 0; n < PATTERNC; ++n) {
+			if (regcomp(&re, patterns[n], cflags[c]))
+				return EXIT_FAILURE;
+
+			// The tail after the last match is shorter than the pattern
+			check(rm, &re, cflags[c], patterns[n], "");
+			check(rm, &re, cflags[c], patterns[n], "aba");
+			check(rm, &re, cflags[c], patterns[n], "abab,aba");
+			check(rm, &re, cflags[c], patterns[n], "\n\na\nb\n");
+
+			for (i = 0; i < ROUNDS; ++i) {
+				fill(s, next(MAXLEN +1));
+				check(rm, &re, cflags[c], patterns[n], s);
+			}
+			regfree(&re);
+		}
+	}
+
+	preg_free(rm);
+
+	return failures;
+}
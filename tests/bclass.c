@@ -0,0 +1,146 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Patterns that reduce to a byte class are searched without regexec(). The
+ * results shall be the ones of regexec(), which the same pattern in
+ * parentheses goes through, in the C locale and in a UTF-8 one, where the
+ * classes of regexec() also match multibyte characters */
+
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <regutils.h>
+#include "check.h"
+
+typedef struct {
+	const char* pattern;
+	int cflags;
+} Pattern;
+
+static const Pattern patterns[] = {
+	{ ",", 0 },
+	{ "[;|]", 0 },
+	{ "[ \t]+", 0 },
+	{ "[]x]", 0 },
+	{ "\\.", 0 },
+	{ "[a-f0-9]", 0 },
+	{ "[^,]+", 0 },
+	{ "[[:space:]]+", 0 },
+	{ "[[:alpha:]]", 0 },
+	{ "[[:digit:][:punct:]]", 0 },
+	{ "[[:upper:]]+", REG_ICASE },
+	{ "k", REG_ICASE },
+	{ "[s,]", REG_ICASE },
+	{ ",", REG_NEWLINE },
+	{ "[^a]", REG_NEWLINE }
+};
+
+static const char* subjects[] = {
+	"a,b;c|d e\tf.g]x",
+	"a\xc2\xa0" "b\xe3\x80\x80" "c d",                  // U+00A0, U+3000
+	"x\xc3\xa9y!z",                                     // U+00E9
+	"K\xe2\x84\xaa" "k \xc5\xbf" "s",                   // U+212A, U+017F
+	"1,2\n3.4\n\n5",
+	"\xc3\x80\xc3\xa0 12 \xd9\xa1\xd9\xa2",             // U+00C0, U+0661
+	""
+};
+
+// Compares the results of "pattern" with the ones of regexec()
+static void compare(const Pattern* pt, const char* subject, const char* loc)
+{
+	Preg* fixed;
+	Preg* re;
+	char wrapped[64];
+	int err;
+	size_t i;
+
+	fixed = preg_init();
+	re = preg_init();
+	if (!fixed || !re) {
+		failures++;
+		goto end;
+	}
+	preg_setopt(fixed, PREG_CFLAGS, pt->cflags);
+	preg_setopt(re, PREG_CFLAGS, pt->cflags);
+	snprintf(wrapped, sizeof(wrapped), "(%s)", pt->pattern);
+
+	err = preg_match(fixed, subject, pt->pattern);
+	if (err != preg_match(re, subject, wrapped) ||
+	    preg_matc(fixed) != preg_matc(re))
+		goto fail;
+	for (i = 0; i < preg_matc(fixed); ++i)
+		if (preg_start(fixed, i, 0) != preg_start(re, i, 0) ||
+		    preg_end(fixed, i, 0) != preg_end(re, i, 0))
+			goto fail;
+
+	err = preg_split(fixed, subject, pt->pattern);
+	if (err != preg_split(re, subject, wrapped) ||
+	    preg_splitc(fixed) != preg_splitc(re))
+		goto fail;
+	for (i = 0; !err && i < preg_splitc(fixed); ++i)
+		if (strcmp(preg_getsplit(fixed, i), preg_getsplit(re, i)))
+			goto fail;
+
+	err = preg_replace(fixed, subject, pt->pattern, "<>");
+	if (err != preg_replace(re, subject, wrapped, "<>") ||
+	    (!err && strcmp(preg_getrep(fixed), preg_getrep(re))))
+		goto fail;
+
+	goto end;
+
+fail:
+	fprintf(stderr, "%s: pattern \"%s\" (cflags %d) differs on \"%s\"\n", loc,
+	        pt->pattern, pt->cflags, subject);
+	failures++;
+end:
+	preg_free(fixed);
+	preg_free(re);
+}
+
+static void compare_all(const char* loc)
+{
+	size_t i, j;
+
+	for (i = 0; i < sizeof(patterns) / sizeof(*patterns); ++i)
+		for (j = 0; j < sizeof(subjects) / sizeof(*subjects); ++j)
+			compare(&patterns[i], subjects[j], loc);
+}
+
+int main(void)
+{
+	const char* utf8[] = { "C.UTF-8", "C.utf8", "en_US.UTF-8" };
+	size_t i;
+
+	if (!setlocale(LC_ALL, "C"))
+		return EXIT_FAILURE;
+	compare_all("C");
+
+	for (i = 0; i < sizeof(utf8) / sizeof(*utf8); ++i)
+		if (setlocale(LC_ALL, utf8[i]))
+			break;
+	if (i == sizeof(utf8) / sizeof(*utf8)) {
+		fprintf(stderr, "No UTF-8 locale, skipped\n");
+		return failures ? failures : SKIP;
+	}
+	compare_all(utf8[i]);
+
+	return failures;
+}
@@ -0,0 +1,154 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* PREG_COMPACT packs the offsets in blocks of 64 matches, each block with
+ * fields as wide as its offsets need. The packed offsets shall read back as
+ * the plain ones, whichever match is asked first. Gaps of a few bytes to
+ * over 64 KB between the matches give blocks of every width a subject of
+ * this size allows; tests/large.c covers the widest one */
+
+#include <stdlib.h>
+#include <string.h>
+#include <regutils.h>
+#include "check.h"
+
+#define MATCHES 500
+#define PATTERN "(x)(y)?[xyz]*|w"
+
+static unsigned int seed = 1;
+
+static unsigned int next(unsigned int n)
+{
+	seed = seed * 1103515245 +12345;
+
+	return (seed >> 16) % n;
+}
+
+/* Returns a subject of MATCHES matches of PATTERN between gaps of '.'. The
+ * gaps of a block are short, long or mixed, block by block */
+static char* subject_make(void)
+{
+	static const char* const words[] = { "x", "xy", "xyzzy", "w", "xzy" };
+	size_t gap[MATCHES];
+	size_t size = 1;
+	size_t len = 0;
+	char* s;
+	int kind = 0;
+	int i;
+
+	for (i = 0; i < MATCHES; ++i) {
+		if (i % 64 == 0)
+			kind = next(4);
+		switch (kind) {
+		case 0:                 // Fit a byte
+			gap[i] = 1 +next(3);
+			break;
+		case 1:                 // Fit 16 bits
+			gap[i] = 200 +next(800);
+			break;
+		case 2:                 // Need 32 bits
+			gap[i] = 60000 +next(20000);
+			break;
+		default:
+			gap[i] = next(8) ? 1 +next(10) : 70000;
+		}
+		size += gap[i] +5;
+	}
+
+	s = malloc(size);
+	if (!s)
+		return NULL;
+
+	for (i = 0; i < MATCHES; ++i) {
+		memset(&s[len], '.', gap[i]);
+		len += gap[i];
+		strcpy(&s[len], words[next(5)]);
+		len += strlen(&s[len]);
+	}
+
+	return s;
+}
+
+static int same_match(const Preg* a, const Preg* b, size_t i)
+{
+	size_t j;
+
+	for (j = 0; j <= preg_subc(a); ++j)
+		if (preg_start(a, i, j) != preg_start(b, i, j) ||
+		    preg_end(a, i, j) != preg_end(b, i, j) ||
+		    preg_so(a, i, j) != preg_so(b, i, j) ||
+		    preg_eo(a, i, j) != preg_eo(b, i, j) ||
+		    preg_matchlen(a, i, j) != preg_matchlen(b, i, j))
+			return 0;
+
+	return 1;
+}
+
+int main(void)
+{
+	static const size_t edges[] = { 0, 1, 62, 63, 64, 65, 127, 128, 255, 256 };
+	Preg* plain;
+	Preg* compact;
+	char* subject = subject_make();
+	size_t matc;
+	size_t i;
+	int k;
+
+	plain = preg_init();
+	compact = preg_init();
+	if (!plain || !compact || !subject)
+		return EXIT_FAILURE;
+
+	for (k = 0; k < 2; ++k) {
+		preg_setopt(compact, PREG_UFLAGS, PREG_COMPACT);
+		if (k) {
+			preg_setopt(plain, PREG_UFLAGS, PREG_NOSTRINGS);
+			preg_setopt(compact, PREG_UFLAGS, PREG_NOSTRINGS);
+		}
+
+		CHECK(!preg_match(plain, subject, PATTERN));
+		CHECK(!preg_match(compact, subject, PATTERN));
+		matc = preg_matc(plain);
+		CHECK(matc == MATCHES);
+		CHECK(preg_matc(compact) == matc);
+
+		// Random access
+		for (i = 0; i < 4 * MATCHES; ++i)
+			CHECK(same_match(plain, compact, next(matc)));
+
+		// The matches around block boundaries, and the last, open block
+		for (i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i)
+			CHECK(same_match(plain, compact, edges[i]));
+		for (i = matc; i > 0 && i > matc -70; --i)
+			CHECK(same_match(plain, compact, i -1));
+
+		if (!k)
+			for (i = 0; i < matc; i += 37)
+				CHECK(!strcmp(preg_getmatch(plain, i, 1),
+				              preg_getmatch(compact, i, 1)));
+	}
+
+	preg_free(plain);
+	preg_free(compact);
+	free(subject);
+
+	return failures;
+}
@@ -0,0 +1,194 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Paging through the matches with a cursor returns the pages that the
+ * PREG_MIN and PREG_LIMIT options select from a search of the whole subject.
+ * The cursor carries whether the resume point is at a line start and whether
+ * it ends a match, so "^" and empty matches shall behave across pages as
+ * they do within a page */
+
+#include <stdlib.h>
+#include <string.h>
+#include <regutils.h>
+#include "check.h"
+
+#define ROUNDS  200
+#define MAXLEN  24
+#define MAXMATC (MAXLEN +2)
+
+static const char* patterns[] = {
+	"^a",
+	"^",
+	"^[ab]*",
+	"a|^b",
+	"^$",
+	"x*",
+	"b*",
+	"$",
+	"(a)(b)?",
+	",|\n"
+};
+
+#define PATTERNC (sizeof(patterns) / sizeof(patterns[0]))
+
+typedef struct {
+	regoff_t so;
+	regoff_t eo;
+} Span;
+
+static unsigned int seed = 1;
+
+static unsigned int next(unsigned int n)
+{
+	seed = seed * 1103515245 +12345;
+
+	return (seed >> 16) % n;
+}
+
+static void fill(char* str, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		str[i] = "ab,\n"[next(4)];
+	str[len] = '\0';
+}
+
+/* Appends the matches "rm" found to "found" and returns their new number */
+static size_t append(const Preg* rm, Span* found, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < preg_matc(rm) && n < MAXMATC; ++i, ++n) {
+		found[n].so = preg_so(rm, i, 0);
+		found[n].eo = preg_eo(rm, i, 0);
+	}
+
+	return n;
+}
+
+/* Pages through the matches of "subject", skipping "skip" matches after
+ * every resume point and returning "page" matches at most per page */
+static size_t pages(Preg* rm, const char* subject, const char* pattern,
+                    int skip, int page, Span* found)
+{
+	Preg_cursor cur;
+	size_t n = 0;
+	size_t calls = 0;
+
+	preg_setopt(rm, PREG_MIN, skip);
+	preg_setopt(rm, PREG_LIMIT, page);
+	while (!preg_match(rm, subject, pattern) && ++calls <= MAXMATC) {
+		n = append(rm, found, n);
+		preg_cursor(rm, &cur);
+		preg_setcursor(rm, &cur);
+	}
+	preg_setcursor(rm, NULL);
+
+	return n;
+}
+
+static void check(Preg* rm, Preg* ref, const char* subject, const char* pattern)
+{
+	Span all[MAXMATC];
+	Span window[MAXMATC];
+	Span paged[MAXMATC];
+	size_t alln = 0;
+	size_t windown = 0;
+	size_t pagedn;
+	size_t i;
+	int page;
+	int ok = 1;
+
+	preg_setopt(ref, PREG_MIN, 0);
+	preg_setopt(ref, PREG_LIMIT, -1);
+	if (!preg_match(ref, subject, pattern))
+		alln = append(ref, all, 0);
+
+	for (page = 1; page <= 3; ++page) {
+		// The windows of PREG_MIN and PREG_LIMIT, one search each
+		preg_setopt(ref, PREG_LIMIT, page);
+		for (windown = 0; windown < alln; windown += page) {
+			preg_setopt(ref, PREG_MIN, windown);
+			if (preg_match(ref, subject, pattern))
+				break;
+			append(ref, window, windown);
+		}
+		ok = ok && windown >= alln;
+
+		pagedn = pages(rm, subject, pattern, 0, page, paged);
+		ok = ok && pagedn == alln;
+		for (i = 0; ok && i < alln; ++i)
+			ok = paged[i].so == all[i].so && paged[i].eo == all[i].eo &&
+			     window[i].so == all[i].so && window[i].eo == all[i].eo;
+
+		// PREG_MIN counts from the resume point
+		pagedn = pages(rm, subject, pattern, 1, page, paged);
+		for (i = 0, windown = 0; ok && i < pagedn; ++i) {
+			if (i % page == 0)
+				windown++;
+			ok = windown < alln && paged[i].so == all[windown].so &&
+			     paged[i].eo == all[windown].eo;
+			windown++;
+		}
+		ok = ok && windown +1 >= alln;
+	}
+
+	if (!ok) {
+		fprintf(stderr, "pattern \"%s\", subject \"%s\"\n", pattern, subject);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	Preg* rm;
+	Preg* ref;
+	char subject[MAXLEN +1];
+	size_t i, n;
+	int c;
+
+	rm = preg_init();
+	ref = preg_init();
+	if (!rm || !ref)
+		return EXIT_FAILURE;
+
+	for (c = 0; c < 2; ++c) {
+		if (c) {
+			preg_setopt(rm, PREG_CFLAGS, REG_NEWLINE);
+			preg_setopt(ref, PREG_CFLAGS, REG_NEWLINE);
+		}
+
+		for (n = 0; n < PATTERNC; ++n) {
+			check(rm, ref, "a\na\nba\n\nb", patterns[n]);
+			check(rm, ref, "aaaa", patterns[n]);
+			for (i = 0; i < ROUNDS; ++i) {
+				fill(subject, next(MAXLEN +1));
+				check(rm, ref, subject, patterns[n]);
+			}
+		}
+	}
+
+	preg_free(rm);
+	preg_free(ref);
+
+	return failures;
+}
@@ -0,0 +1,171 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Subjects larger than 4 GB, whose offsets do not fit in regoff_t. Holes of a
+ * sparse file read back as null bytes, which would end the subject, so the
+ * subject is rather made of the same 2 MiB block of a small file mapped over
+ * and over, followed by a last block holding the match. The first block
+ * starts with a digit instead, as do the last ones. It takes little more
+ * memory or disk than the file, but every search reads all of it.
+ *
+ * The test is skipped where a subject of that size cannot be mapped */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <regutils.h>
+#include "check.h"
+
+#define BLOCK_SIZE (2 * 1024 * 1024)
+#define LINE_SIZE  (256 * 1024)         // Lines per block: 8
+#define BLOCKS     2200                 // 4.6 GB
+
+#define DIGITS     130                  // Over two blocks of PREG_COMPACT
+
+static const char tail[] = "bbb\nthe needle\nccc "
+	"0123456789012345678901234567890123456789012345678901234567890123456789"
+	"012345678901234567890123456789012345678901234567890123456789";
+
+/* Maps BLOCKS filler blocks, the first with a digit, followed by the tail
+ * block, and returns the subject, or NULL if it cannot be mapped */
+static char* subject_map(size_t* len)
+{
+	FILE* f;
+	char* block;
+	char* s;
+	size_t i;
+	int fd;
+
+	if (sizeof(size_t) < 8 || !(f = tmpfile()))
+		return NULL;
+	fd = fileno(f);
+
+	// Lines of 'a's. The tail block is followed by null bytes, then by the
+	// first block
+	block = malloc(BLOCK_SIZE);
+	if (!block)
+		return NULL;
+	memset(block, 'a', BLOCK_SIZE);
+	for (i = LINE_SIZE -1; i < BLOCK_SIZE; i += LINE_SIZE)
+		block[i] = '\n';
+	if (write(fd, block, BLOCK_SIZE) != BLOCK_SIZE ||
+	    write(fd, tail, sizeof(tail)) != sizeof(tail) ||
+	    ftruncate(fd, 2 * BLOCK_SIZE))
+		return NULL;
+	block[0] = '0';
+	if (pwrite(fd, block, BLOCK_SIZE, 2 * BLOCK_SIZE) != BLOCK_SIZE)
+		return NULL;
+	free(block);
+
+	s = mmap(NULL, (BLOCKS +1) * (size_t)BLOCK_SIZE, PROT_NONE,
+	         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (s == MAP_FAILED)
+		return NULL;
+
+	for (i = 0; i <= BLOCKS; ++i)
+		if (mmap(s +i * BLOCK_SIZE, BLOCK_SIZE, PROT_READ,
+		         MAP_SHARED | MAP_FIXED, fd,
+		         !i ? 2 * BLOCK_SIZE : i < BLOCKS ? 0 : BLOCK_SIZE)
+		    == MAP_FAILED)
+			return NULL;
+
+	*len = BLOCKS * (size_t)BLOCK_SIZE +strlen(tail);
+
+	return s;
+}
+
+int main(void)
+{
+	const size_t lines = BLOCKS * (BLOCK_SIZE / LINE_SIZE);
+	const size_t needle = BLOCKS * (size_t)BLOCK_SIZE +8;
+	const size_t digits = needle +11;
+	Preg* rm;
+	char* s;
+	size_t len;
+	size_t line;
+	size_t col;
+	size_t i;
+
+	s = subject_map(&len);
+	if (!s)
+		return SKIP;
+	CHECK(len > UINT32_MAX);
+
+	rm = preg_init();
+	if (!rm)
+		return EXIT_FAILURE;
+	preg_setopt(rm, PREG_UFLAGS, PREG_NOSTRINGS);
+
+	// The regex path, searching the subject in windows
+	CHECK(!preg_match(rm, s, "needl[e]"));
+	CHECK(preg_matc(rm) == 1);
+	CHECK(preg_start(rm, 0, 0) == (ssize_t)needle);
+	CHECK(preg_end(rm, 0, 0) == (ssize_t)needle +6);
+
+	// The literal kernel
+	preg_setopt(rm, PREG_UFLAGS, PREG_LITERAL);
+	CHECK(!preg_match(rm, s, "needle"));
+	CHECK(preg_start(rm, 0, 0) == (ssize_t)needle);
+	preg_delopt(rm, PREG_UFLAGS, PREG_LITERAL);
+
+	// The byte class kernel, over every line
+	CHECK(!preg_match(rm, s, "\n"));
+	CHECK(preg_matc(rm) == lines +2);
+	CHECK(preg_start(rm, lines, 0) == (ssize_t)needle -5);
+	CHECK(preg_start(rm, lines +1, 0) == (ssize_t)needle +6);
+
+	// A range of matches
+	preg_setopt(rm, PREG_MIN, lines +2);
+	preg_setopt(rm, PREG_LIMIT, 1);
+	CHECK(!preg_match(rm, s, "[a-z]+"));
+	CHECK(preg_matc(rm) == 1);
+	CHECK(preg_start(rm, 0, 0) == (ssize_t)needle);
+	preg_setopt(rm, PREG_MIN, 0);
+	preg_setopt(rm, PREG_LIMIT, -1);
+
+	/* Packed offsets. The first block of them holds the digit at the start
+	 * and the first ones of the tail, so its starts need 64 bits */
+	preg_setopt(rm, PREG_UFLAGS, PREG_COMPACT);
+	CHECK(!preg_match(rm, s, "[0-9]"));
+	CHECK(preg_matc(rm) == DIGITS +1);
+	CHECK(preg_start(rm, 0, 0) == 0 && preg_end(rm, 0, 0) == 1);
+	for (i = DIGITS; i > 0; --i)
+		CHECK(preg_start(rm, i, 0) == (ssize_t)(digits +i -1) &&
+		      preg_end(rm, i, 0) == (ssize_t)(digits +i));
+	preg_delopt(rm, PREG_UFLAGS, PREG_COMPACT);
+
+	// Line numbers
+	CHECK(!preg_grep(rm, s, "needl[e]"));
+	CHECK(preg_matc(rm) == 1);
+	CHECK(preg_grepline(rm, 0) == lines +1);
+	preg_linecol(rm, needle, &line, &col);
+	CHECK(line == lines +1 && col == 4);
+
+	// A pattern that can match a newline cannot be searched in windows
+	CHECK(preg_match(rm, s, "a.*needle") == PREG_TOOLARGE);
+
+	preg_free(rm);
+
+	return failures;
+}
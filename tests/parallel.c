@@ -0,0 +1,224 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* A preg_replace() with PREG_THREADS returns the same result as the serial
+ * one, byte for byte, and its matches count against PREG_MAXMEM like those
+ * of the serial one. The subject is long enough to be split into parts */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <regutils.h>
+#include "check.h"
+
+#define LINES   40000
+#define THREADS 4
+#define MAXMEM  (1024 * 1024)
+
+/* The allocator keeps the size of every block in front of it, so that the
+ * bytes alive and their peak can be counted */
+typedef union {
+	size_t size;
+	long double align;
+} Header;
+
+static size_t live;             // Bytes allocated and not freed yet
+static size_t peak;             // The maximum of "live"
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void count(size_t add, size_t sub)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&lock);
+#endif
+	live += add;
+	live -= sub;
+	if (live > peak)
+		peak = live;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&lock);
+#endif
+}
+
+static void* count_alloc(void* ctx, size_t size)
+{
+	Header* h = malloc(sizeof(Header) +size);
+
+	(void)ctx;
+	if (!h)
+		return NULL;
+	h->size = size;
+	count(size, 0);
+
+	return h +1;
+}
+
+static void* count_realloc(void* ctx, void* ptr, size_t size)
+{
+	Header* h = ptr ? (Header*)ptr -1 : NULL;
+	size_t old = h ? h->size : 0;
+
+	(void)ctx;
+	h = realloc(h, sizeof(Header) +size);
+	if (!h)
+		return NULL;
+	h->size = size;
+	count(size, old);
+
+	return h +1;
+}
+
+static void count_free(void* ctx, void* ptr)
+{
+	Header* h;
+
+	(void)ctx;
+	if (!ptr)
+		return;
+	h = (Header*)ptr -1;
+	count(0, h->size);
+	free(h);
+}
+
+static const Preg_allocator alloc = {
+	count_alloc, count_realloc, count_free, NULL
+};
+
+static const struct {
+	const char* pattern;
+	const char* rep;
+	int cflags;
+} cases[] = {
+	{ "[0-9]+", "#", 0 },
+	{ "([a-z]+)=([0-9]+)", "$2=$1", 0 },
+	{ "(x)?(id|ms)", "<$1|$2|$0>", 0 },
+	{ "[a-z]+", "$0$0", 0 },
+	{ ";", "", 0 },
+	{ "x*", "-", 0 },
+	{ "b*", "[$0]", 0 },
+	{ "^", "> ", REG_NEWLINE },
+	{ "$", " <", REG_NEWLINE },
+	{ "^[a-z]+", "$0:", REG_NEWLINE },
+	{ "^id", "ID", 0 },
+	{ "[0-9]$", "!", REG_NEWLINE },
+	{ "ms=[0-9]+", "$3", 0 }
+};
+
+#define CASEC (sizeof(cases) / sizeof(cases[0]))
+
+static char* subject_make(void)
+{
+	static const char* const words[] = {
+		"id", "ms", "bbb", "status", "x", "xx", ";", "a=1", "b"
+	};
+	char* s = malloc(LINES * 64);
+	size_t len = 0;
+	unsigned long r = 1;
+	int i;
+	int j;
+
+	if (!s)
+		return NULL;
+
+	for (i = 0; i < LINES; ++i) {
+		len += sprintf(&s[len], "id=%d ms=%d", i, i * 7 % 1000);
+		for (j = 0; j < 3; ++j) {
+			r = r * 1103515245 +12345;
+			len += sprintf(&s[len], " %s", words[(r >> 16) % 9]);
+		}
+		// Some lines are empty
+		s[len++] = '\n';
+		if (i % 17 == 0)
+			s[len++] = '\n';
+	}
+	s[len] = '\0';
+
+	return s;
+}
+
+int main(void)
+{
+	Preg* serial = preg_init();
+	Preg* parallel = preg_init();
+	Preg* limited = preg_init_ex(&alloc);
+	char* subject = subject_make();
+	const char* a;
+	const char* b;
+	size_t i;
+	int same;
+	int err1;
+	int err2;
+
+	if (!serial || !parallel || !limited || !subject)
+		return EXIT_FAILURE;
+
+	preg_setopt(parallel, PREG_THREADS, THREADS);
+	for (i = 0; i < CASEC; ++i) {
+		preg_delopt(serial, PREG_CFLAGS, REG_NEWLINE);
+		preg_delopt(parallel, PREG_CFLAGS, REG_NEWLINE);
+		preg_setopt(serial, PREG_CFLAGS, cases[i].cflags);
+		preg_setopt(parallel, PREG_CFLAGS, cases[i].cflags);
+
+		err1 = preg_replace(serial, subject, cases[i].pattern, cases[i].rep);
+		err2 = preg_replace(parallel, subject, cases[i].pattern,
+		                    cases[i].rep);
+		CHECK(err1 == err2);
+		if (err1 || err2)
+			continue;
+
+		a = preg_getrep(serial);
+		b = preg_getrep(parallel);
+		same = preg_replen(serial) == preg_replen(parallel) &&
+		       !memcmp(a, b, preg_replen(serial));
+		if (!same)
+			fprintf(stderr, "%s: the results differ\n", cases[i].pattern);
+		CHECK(same);
+		CHECK(preg_matc(serial) == preg_matc(parallel));
+	}
+
+	/* Every letter matches, so the matches take many times the budget. The
+	 * parts of the subject shall not hold them all before failing */
+	preg_setopt(limited, PREG_THREADS, THREADS);
+	preg_setopt(limited, PREG_MAXMEM, MAXMEM);
+	CHECK(preg_replace(limited, subject, "[a-z]", "-") == PREG_MEMLIMIT);
+	CHECK(peak < 2 * MAXMEM);
+
+	// Within the budget it is still the serial result
+	peak = 0;
+	preg_setopt(limited, PREG_MAXMEM, 64 * MAXMEM);
+	CHECK(!preg_replace(limited, subject, "[0-9]+", "#"));
+	CHECK(!preg_replace(serial, subject, "[0-9]+", "#"));
+	CHECK(preg_replen(limited) == preg_replen(serial));
+	CHECK(!strcmp(preg_getrep(limited), preg_getrep(serial)));
+
+	preg_free(serial);
+	preg_free(parallel);
+	preg_free(limited);
+	free(subject);
+
+	return failures;
+}
@@ -0,0 +1,189 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* A pool keeps up to "max" idle handles in all, whichever threads return
+ * them. The handles alive are counted by the allocator of the pool */
+
+#include "config.h"
+
+#include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <regutils.h>
+#include "check.h"
+
+#define HANDLES 8
+
+static size_t live;             // Blocks allocated and not freed yet
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void count(long n)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&lock);
+#endif
+	live += n;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&lock);
+#endif
+}
+
+static void* count_alloc(void* ctx, size_t size)
+{
+	void* ptr = malloc(size);
+
+	(void)ctx;
+	if (ptr)
+		count(1);
+
+	return ptr;
+}
+
+static void* count_realloc(void* ctx, void* ptr, size_t size)
+{
+	void* res = realloc(ptr, size);
+
+	(void)ctx;
+	if (res && !ptr)
+		count(1);
+
+	return res;
+}
+
+static void count_free(void* ctx, void* ptr)
+{
+	(void)ctx;
+	free(ptr);
+	count(-1);
+}
+
+static const Preg_allocator alloc = {
+	count_alloc, count_realloc, count_free, NULL
+};
+
+typedef struct {
+	Preg_pool* pool;
+	Preg* rm;
+} Job;
+
+#ifdef HAVE_PTHREAD
+static void* put(void* arg)
+{
+	Job* job = arg;
+
+	preg_pool_put(job->pool, job->rm);
+
+	return NULL;
+}
+#endif
+
+// Returns the number of blocks of "n" handles of "pool" that are in use
+static size_t handles_put(Preg_pool* pool, Preg** rm, size_t n, int threads)
+{
+#ifdef HAVE_PTHREAD
+	pthread_t tids[HANDLES];
+	Job job[HANDLES];
+	int started[HANDLES] = { 0 };
+#endif
+	size_t i;
+
+	(void)threads;
+	for (i = 0; i < n; ++i) {
+#ifdef HAVE_PTHREAD
+		if (threads) {
+			job[i].pool = pool;
+			job[i].rm = rm[i];
+			started[i] = !pthread_create(&tids[i], NULL, put, &job[i]);
+			if (started[i])
+				continue;
+		}
+#endif
+		preg_pool_put(pool, rm[i]);
+	}
+#ifdef HAVE_PTHREAD
+	for (i = 0; i < n; ++i)
+		if (started[i])
+			pthread_join(tids[i], NULL);
+#endif
+
+	return live;
+}
+
+int main(void)
+{
+	Preg_pool* pool;
+	Preg* rm[HANDLES];
+	Preg* extra;
+	size_t empty, handle;
+	size_t i;
+
+	// A single handle from a single thread
+	pool = preg_pool_init(1, &alloc);
+	if (!pool)
+		return EXIT_FAILURE;
+	empty = live;
+	rm[0] = preg_pool_get(pool);
+	if (!rm[0])
+		return EXIT_FAILURE;
+	handle = live -empty;
+	CHECK(handle > 0);
+
+	for (i = 1; i < HANDLES; ++i)
+		if (!(rm[i] = preg_pool_get(pool)))
+			return EXIT_FAILURE;
+	CHECK(live == empty +HANDLES * handle);
+	CHECK(handles_put(pool, rm, HANDLES, 0) == empty +handle);
+
+	// And from as many threads, which fall in different shards
+	for (i = 0; i < HANDLES; ++i)
+		if (!(rm[i] = preg_pool_get(pool)))
+			return EXIT_FAILURE;
+	CHECK(handles_put(pool, rm, HANDLES, 1) == empty +handle);
+	preg_pool_free(pool);
+	CHECK(live == 0);
+
+	// A single thread may fill the whole pool
+	pool = preg_pool_init(HANDLES, &alloc);
+	if (!pool)
+		return EXIT_FAILURE;
+	empty = live;
+	for (i = 0; i < HANDLES; ++i)
+		if (!(rm[i] = preg_pool_get(pool)))
+			return EXIT_FAILURE;
+	if (!(extra = preg_pool_get(pool)))
+		return EXIT_FAILURE;
+	preg_pool_put(pool, extra);
+	CHECK(handles_put(pool, rm, HANDLES, 0) == empty +HANDLES * handle);
+
+	// The idle handles are taken back before any new one
+	for (i = 0; i < HANDLES; ++i)
+		if (!(rm[i] = preg_pool_get(pool)))
+			return EXIT_FAILURE;
+	CHECK(live == empty +HANDLES * handle);
+	CHECK(handles_put(pool, rm, HANDLES, 1) == empty +HANDLES * handle);
+	preg_pool_free(pool);
+	CHECK(live == 0);
+
+	return failures;
+}
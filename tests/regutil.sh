@@ -0,0 +1,32 @@
+#!/bin/sh
+# regutil(1) ends its output like its input: replace and split leave out the
+# last newline when the input lacks it
+
+regutil=./tools/regutil
+failures=0
+
+check()
+{
+	expected=$(printf "$1" | od -c)
+	shift
+	actual=$(printf "$input" | $regutil "$@" | od -c)
+	if [ "$expected" != "$actual" ]; then
+		echo "regutil $*: unexpected output:" >&2
+		echo "$actual" >&2
+		failures=$((failures +1))
+	fi
+}
+
+input='abc\nxbx'
+check 'aQc\nxQx' replace b Q
+check 'abc\nxbx\n' match b
+check 'a\nc\nx\nx' split b
+
+input='abc\nxbx\n'
+check 'aQc\nxQx\n' replace b Q
+check 'a\nc\nx\nx\n' split b
+
+input='abc\nxbx'
+check 'aQc\nxQx' -j 2 replace b Q
+
+exit $failures
@@ -0,0 +1,189 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* preg_rematch() against a full preg_match() of the edited subject, on small
+ * random subjects and edits. The alphabet includes newlines, as REG_NEWLINE
+ * makes the matches depend on the byte preceding them. Then many edits of a
+ * large subject, whose results shall not keep more memory as they go */
+
+#include <stdlib.h>
+#include <string.h>
+#include <regutils.h>
+#include "check.h"
+
+#define ROUNDS  2000
+#define MAXLEN  12
+#define WORDS   40000           // Matches of the large subject
+#define EDITS   500
+
+static const char* patterns[] = {
+	"b|\n|^a",
+	"^a|b$",
+	"^[ab]",
+	"a\nb|^b",
+	"(a|b)a?",
+	"ab|ba"
+};
+
+static unsigned int seed = 1;
+
+static int same(const Preg* a, const Preg* b);
+
+static unsigned int next(unsigned int n)
+{
+	seed = seed * 1103515245 +12345;
+
+	return (seed >> 16) % n;
+}
+
+static void fill(char* str, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		str[i] = "ab\n"[next(3)];
+	str[len] = '\0';
+}
+
+// Edits single bytes of a subject of WORDS words in place, one at a time
+static void edit_large(Preg* inc, Preg* ref)
+{
+	const char* pattern = "[a-z]{1,5}";
+	Preg_stats stats;
+	char* subject;
+	size_t len = 0;
+	size_t retained;
+	size_t i, n;
+
+	subject = malloc(WORDS * 6 +1);
+	if (!subject) {
+		failures++;
+		return;
+	}
+	for (i = 0; i < WORDS; ++i) {
+		for (n = 1 +next(5); n; --n)
+			subject[len++] = "abcdefgh"[next(8)];
+		subject[len++] = ' ';
+	}
+	subject[len] = '\0';
+
+	CHECK(!preg_match(inc, subject, pattern));
+	preg_stats(inc, &stats);
+	retained = stats.pool_retained;
+
+	for (i = 0; i < EDITS; ++i) {
+		n = next(len);
+		subject[n] = next(4) ? "abcdefgh"[next(8)] : ' ';
+		preg_rematch(inc, subject, pattern, n, 1, 1);
+	}
+
+	// The arena may hold the dropped results of the edits, but only up to
+	// about as much as the live ones
+	preg_stats(inc, &stats);
+	CHECK(stats.pool_retained <= 3 * retained);
+
+	preg_match(ref, subject, pattern);
+	CHECK(same(inc, ref));
+
+	free(subject);
+}
+
+static int same(const Preg* a, const Preg* b)
+{
+	size_t i;
+
+	if (preg_errcode(a) != preg_errcode(b) || preg_matc(a) != preg_matc(b))
+		return 0;
+
+	for (i = 0; i < preg_matc(a); ++i)
+		if (preg_so(a, i, 0) != preg_so(b, i, 0) ||
+		    preg_eo(a, i, 0) != preg_eo(b, i, 0) ||
+		    strcmp(preg_getmatch(a, i, 0), preg_getmatch(b, i, 0)))
+			return 0;
+
+	return 1;
+}
+
+static void check(Preg* inc, Preg* ref, const char* pattern, const char* old,
+                  size_t offset, size_t deleted, const char* ins)
+{
+	char subject[2 * MAXLEN +1];
+	size_t inserted = strlen(ins);
+
+	memcpy(subject, old, offset);
+	memcpy(&subject[offset], ins, inserted);
+	strcpy(&subject[offset +inserted], &old[offset +deleted]);
+
+	preg_match(inc, old, pattern);
+	preg_rematch(inc, subject, pattern, offset, deleted, inserted);
+	preg_match(ref, subject, pattern);
+
+	if (!same(inc, ref)) {
+		fprintf(stderr, "pattern \"%s\", \"%s\" -> \"%s\"\n", pattern, old,
+		        subject);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	Preg* inc;
+	Preg* ref;
+	char old[MAXLEN +1];
+	char ins[MAXLEN +1];
+	size_t len, offset, deleted;
+	size_t i, n;
+
+	inc = preg_init();
+	ref = preg_init();
+	if (!inc || !ref)
+		return EXIT_FAILURE;
+
+	preg_setopt(inc, PREG_CFLAGS, REG_NEWLINE);
+	preg_setopt(ref, PREG_CFLAGS, REG_NEWLINE);
+
+	// A newline inserted right before the resynchronization point
+	check(inc, ref, "b|\n|^a", "bba", 1, 1, "\n");
+	CHECK(preg_matc(inc) == 3);
+
+	// And one deleted
+	check(inc, ref, "b|\n|^a", "b\na", 1, 1, "b");
+	CHECK(preg_matc(inc) == 2);
+
+	for (n = 0; n < sizeof(patterns) / sizeof(*patterns); ++n)
+		for (i = 0; i < ROUNDS; ++i) {
+			len = next(MAXLEN +1);
+			fill(old, len);
+			offset  = next(len +1);
+			deleted = next(len -offset +1);
+			fill(ins, next(4));
+			check(inc, ref, patterns[n], old, offset, deleted, ins);
+		}
+
+	preg_delopt(inc, PREG_CFLAGS, REG_NEWLINE);
+	preg_delopt(ref, PREG_CFLAGS, REG_NEWLINE);
+	edit_large(inc, ref);
+
+	preg_free(inc);
+	preg_free(ref);
+
+	return failures;
+}
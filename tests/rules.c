@@ -0,0 +1,95 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* preg_replace_rules() searches the rules from the scan position, where a
+ * rule compiled with REG_NEWLINE shall see a line start after a newline, and
+ * counts the matches it replaces like preg_replace() does */
+
+#include <stdlib.h>
+#include <string.h>
+#include <regutils.h>
+#include "check.h"
+
+#define LINES   20000
+
+int main(void)
+{
+	Preg* rm;
+	Preg_stats stats;
+	char* subject;
+	size_t i;
+
+	rm = preg_init();
+	if (!rm)
+		return EXIT_FAILURE;
+
+	// "^a" matches at the line start the first rule leaves the scan at
+	preg_setopt(rm, PREG_CFLAGS, REG_NEWLINE);
+	CHECK(!preg_addrule(rm, "x\n", "Y"));
+	CHECK(!preg_addrule(rm, "^a|x", "Z"));
+	CHECK(!preg_replace_rules(rm, "x\na"));
+	CHECK(!strcmp(preg_getrep(rm), "YZ"));
+	CHECK(!preg_replace_rules(rm, "xa\nax"));
+	CHECK(!strcmp(preg_getrep(rm), "Za\nZZ"));
+
+	// But not without REG_NEWLINE
+	preg_clearrules(rm);
+	preg_delopt(rm, PREG_CFLAGS, REG_NEWLINE);
+	CHECK(!preg_addrule(rm, "x\n", "Y"));
+	CHECK(!preg_addrule(rm, "^a|x", "Z"));
+	CHECK(!preg_replace_rules(rm, "x\na"));
+	CHECK(!strcmp(preg_getrep(rm), "Ya"));
+
+	// The matches skipped by PREG_MIN are not counted
+	preg_setopt(rm, PREG_UFLAGS, PREG_STATS);
+	preg_setopt(rm, PREG_MIN, 1);
+	preg_stats_reset(rm);
+	CHECK(!preg_replace_rules(rm, "x\naxx"));
+	CHECK(!strcmp(preg_getrep(rm), "x\naZZ"));
+	preg_stats(rm, &stats);
+	CHECK(stats.matches == 2);
+	preg_setopt(rm, PREG_MIN, 0);
+
+	// Many matches on a long subject, at every line start
+	preg_clearrules(rm);
+	preg_setopt(rm, PREG_CFLAGS, REG_NEWLINE);
+	CHECK(!preg_addrule(rm, "x\n", "Y"));
+	CHECK(!preg_addrule(rm, "^a|x", "Z"));
+
+	subject = malloc(3 * LINES +1);
+	if (!subject)
+		return EXIT_FAILURE;
+	for (i = 0; i < LINES; ++i)
+		memcpy(&subject[3 * i], "ax\n", 3);
+	subject[3 * LINES] = '\0';
+
+	preg_stats_reset(rm);
+	CHECK(!preg_replace_rules(rm, subject));
+	preg_stats(rm, &stats);
+	CHECK(stats.matches == 2 * LINES);
+	CHECK(!strncmp(preg_getrep(rm), "ZYZY", 4));
+	CHECK(preg_replen(rm) == 2 * LINES);
+
+	free(subject);
+	preg_free(rm);
+
+	return failures;
+}
@@ -0,0 +1,146 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* The patterns regutils.hpp escapes and classifies at compile time shall
+ * behave as their runtime counterparts: escape() as preg_escape(), and the
+ * literal and byte class kernels the classification dispatches to as the
+ * regex path. The same pattern wrapped in a subexpression takes the regex
+ * path, as neither kernel takes parentheses */
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <regutils.hpp>
+#include "check.h"
+
+using regutils::Pattern_kind;
+
+static const char* const subjects[] = {
+	"",
+	"plain words, and more words",
+	"a.b*c a.b (x) [y] +++ ,, ;|; \t\t tab  end",
+	"^$ \\ \\\\ {1} ? | a.b.a.b",
+	"a.b\na.b\n\n;;\n"
+};
+
+static void check_escape(std::string_view escaped, const char* s,
+                         Preg_notation nota)
+{
+	char* res = preg_escape(s, nota, std::strlen(s));
+
+	CHECK(res && escaped == res);
+	std::free(res);
+}
+
+/* Compares the matches and the replacements of "pat" searched by "h" with
+ * those of "regex" on the regex path */
+template <std::size_t N>
+static void check_search(regutils::Handle& h,
+                         const regutils::Static_pattern<N>& pat,
+                         const std::string& regex)
+{
+	Preg* ref = preg_init();
+	std::string rep;
+	std::size_t i;
+	int err;
+
+	if (!ref)
+		std::exit(EXIT_FAILURE);
+
+	for (const char* subject : subjects) {
+		err = h.match(subject, pat);
+		CHECK(err == preg_match(ref, subject, regex.c_str()));
+		if (!err) {
+			CHECK(h.matc() == preg_matc(ref));
+			for (i = 0; i < h.matc() && i < preg_matc(ref); ++i) {
+				CHECK(preg_start(h.get(), i, 0) == preg_start(ref, i, 0));
+				CHECK(preg_end(h.get(), i, 0) == preg_end(ref, i, 0));
+			}
+		}
+
+		err = h.replace(subject, pat, "<$0>");
+		CHECK(err == preg_replace(ref, subject, regex.c_str(), "<$0>"));
+		if (!err)
+			CHECK(h.rep() == preg_getrep(ref));
+	}
+
+	preg_free(ref);
+}
+
+// A literal, escaped at runtime for the regex path
+#define LITERAL(h, s) \
+	do { \
+		constexpr auto pat = regutils::literal(s); \
+		constexpr auto ere = regutils::escape(s, PREG_ERE); \
+		constexpr auto bre = regutils::escape(s, PREG_BRE); \
+		static_assert(pat.kind == Pattern_kind::literal); \
+		check_escape(ere.view(), s, PREG_ERE); \
+		check_escape(bre.view(), s, PREG_BRE); \
+		check_search(h, pat, "(" +std::string(ere.view()) +")"); \
+	} while (0)
+
+// A pattern classified at compile time as "k"
+#define PATTERN(h, s, k) \
+	do { \
+		constexpr auto pat = regutils::pattern(s); \
+		static_assert(pat.kind == k); \
+		check_search(h, pat, "(" +std::string(s) +")"); \
+	} while (0)
+
+int main()
+{
+	regutils::Handle h;
+
+	LITERAL(h, "a.b");
+	LITERAL(h, "(x)");
+	LITERAL(h, "[y]");
+	LITERAL(h, "+");
+	LITERAL(h, "\\");
+	LITERAL(h, "^$");
+	LITERAL(h, "{1} ?");
+	LITERAL(h, "a.b.a");
+	LITERAL(h, "\n");
+	LITERAL(h, "^$.[()|*+?{\\");
+
+	PATTERN(h, "end", Pattern_kind::literal);
+	PATTERN(h, "words", Pattern_kind::literal);
+	PATTERN(h, ", ", Pattern_kind::literal);
+	PATTERN(h, ",", Pattern_kind::literal);
+	PATTERN(h, "[;|]", Pattern_kind::byte_class);
+	PATTERN(h, "[;|]+", Pattern_kind::byte_class);
+	PATTERN(h, "[ \t]+", Pattern_kind::byte_class);
+	PATTERN(h, "[^a-z]+", Pattern_kind::byte_class);
+	PATTERN(h, "[[:space:]]+", Pattern_kind::byte_class);
+	PATTERN(h, "[]]", Pattern_kind::byte_class);
+	PATTERN(h, "\\.", Pattern_kind::byte_class);
+	PATTERN(h, "\\++", Pattern_kind::byte_class);
+	PATTERN(h, ".", Pattern_kind::regex);
+	PATTERN(h, "a.b", Pattern_kind::regex);
+	PATTERN(h, "[;|]*", Pattern_kind::regex);
+	PATTERN(h, "[a-z]+s", Pattern_kind::regex);
+
+	// The same handle also searches the patterns given at runtime
+	CHECK(!h.match("a.b", "a.b"));
+	CHECK(h.matc() == 1);
+
+	return failures;
+}
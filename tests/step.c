@@ -0,0 +1,186 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* A search split into steps by PREG_STEPBYTES or PREG_STEPEXECS returns
+ * PREG_INPROGRESS until its last step, whose results shall be those of a
+ * single call without a budget. The budgets of one byte and one search make
+ * every match, and every empty match, end a step of its own */
+
+#include <stdlib.h>
+#include <string.h>
+#include <regutils.h>
+#include "check.h"
+
+static const struct {
+	const char* pattern;
+	const char* rep;
+	int cflags;
+} patterns[] = {
+	{ ",", ";", 0 },                // Reduces to a set of bytes
+	{ "[ \t]+", "", 0 },
+	{ "[a-z]+", "<$0>", 0 },
+	{ "([a-z]+)=([0-9]*)", "$2=$1", 0 },
+	{ "(x)?(id|ms)", "<$1|$2>", 0 },
+	{ "x*", "-", 0 },               // Empty matches
+	{ "^", "> ", REG_NEWLINE },
+	{ "$", "<", REG_NEWLINE },
+	{ "^[a-z]+", "$0$0", REG_NEWLINE },
+	{ "^id", "ID", 0 },
+	{ "[0-9]$", "!", REG_NEWLINE },
+	{ "nowhere", "", 0 }
+};
+
+#define PATTERNC (sizeof(patterns) / sizeof(patterns[0]))
+
+static const char* const subjects[] = {
+	"",
+	"id=1",
+	"id=12, ms=3\tstatus=ok\nx id=, xx ms=40\n\nlast=9",
+	",,\n, ,\n"
+};
+
+#define SUBJECTC (sizeof(subjects) / sizeof(subjects[0]))
+
+static const int budgets[][2] = {
+	{ PREG_STEPBYTES, 1 },
+	{ PREG_STEPEXECS, 1 },
+	{ PREG_STEPBYTES, 3 }
+};
+
+#define BUDGETC (sizeof(budgets) / sizeof(budgets[0]))
+
+enum { MATCH, REPLACE, SPLIT };
+
+static int run(Preg* rm, int op, const char* subject, size_t i)
+{
+	const char* pattern = patterns[i].pattern;
+
+	switch (op) {
+	case MATCH:
+		return preg_match(rm, subject, pattern);
+	case REPLACE:
+		return preg_replace(rm, subject, pattern, patterns[i].rep);
+	default:
+		return preg_split(rm, subject, pattern);
+	}
+}
+
+/* Repeats "op" on "subject" until its last step and returns its result */
+static int steps(Preg* rm, int op, const char* subject, size_t i, size_t* n)
+{
+	size_t max = 2 * strlen(subject) +4;
+	int err;
+
+	*n = 0;
+	do {
+		err = run(rm, op, subject, i);
+		++*n;
+	} while (err == PREG_INPROGRESS && *n < max);
+
+	return err;
+}
+
+static int same(const Preg* a, const Preg* b, int op)
+{
+	size_t i;
+	size_t j;
+
+	if (preg_errcode(a) != preg_errcode(b))
+		return 0;
+	if (preg_errcode(a))
+		return 1;
+
+	switch (op) {
+	case MATCH:
+		if (preg_matc(a) != preg_matc(b) || preg_subc(a) != preg_subc(b))
+			return 0;
+		for (i = 0; i < preg_matc(a); ++i)
+			for (j = 0; j <= preg_subc(a); ++j)
+				if (preg_so(a, i, j) != preg_so(b, i, j) ||
+				    preg_eo(a, i, j) != preg_eo(b, i, j) ||
+				    strcmp(preg_getmatch(a, i, j), preg_getmatch(b, i, j)))
+					return 0;
+		return 1;
+	case REPLACE:
+		return preg_replen(a) == preg_replen(b) &&
+		       !strcmp(preg_getrep(a), preg_getrep(b));
+	default:
+		if (preg_splitc(a) != preg_splitc(b))
+			return 0;
+		for (i = 0; i < preg_splitc(a); ++i)
+			if (strcmp(preg_getsplit(a, i), preg_getsplit(b, i)))
+				return 0;
+		return 1;
+	}
+}
+
+int main(void)
+{
+	Preg* step;
+	Preg* once;
+	const char* subject;
+	size_t i, j, k;
+	size_t n;
+	size_t resumed = 0;
+	int op;
+
+	step = preg_init();
+	once = preg_init();
+	if (!step || !once)
+		return EXIT_FAILURE;
+
+	for (k = 0; k < BUDGETC; ++k) {
+		preg_delopt(step, PREG_STEPBYTES, 0);
+		preg_delopt(step, PREG_STEPEXECS, 0);
+		preg_setopt(step, budgets[k][0], budgets[k][1]);
+
+		for (i = 0; i < PATTERNC; ++i) {
+			preg_delopt(step, PREG_CFLAGS, REG_NEWLINE);
+			preg_delopt(once, PREG_CFLAGS, REG_NEWLINE);
+			preg_setopt(step, PREG_CFLAGS, patterns[i].cflags);
+			preg_setopt(once, PREG_CFLAGS, patterns[i].cflags);
+
+			for (j = 0; j < SUBJECTC; ++j)
+				for (op = MATCH; op <= SPLIT; ++op) {
+					subject = subjects[j];
+					run(once, op, subject, i);
+					CHECK(steps(step, op, subject, i, &n) != PREG_INPROGRESS);
+					if (n > 1)
+						resumed++;
+
+					if (!same(step, once, op)) {
+						fprintf(stderr, "pattern \"%s\", subject %d, "
+						        "operation %d\n", patterns[i].pattern, (int)j,
+						        op);
+						failures++;
+					}
+				}
+		}
+	}
+
+	// The searches were split indeed
+	CHECK(resumed > 0);
+
+	preg_free(step);
+	preg_free(once);
+
+	return failures;
+}
@@ -0,0 +1,95 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* PREG_SUBMASK only applies to preg_match(). The replace functions need the
+ * offsets of every subexpression, whatever the option and the mode the
+ * previous call left */
+
+#include <stdlib.h>
+#include <string.h>
+#include <regutils.h>
+#include "check.h"
+
+static int wrap(Preg_buf* buf, const char* subject, const regmatch_t* match,
+                size_t nmatch, void* ctx)
+{
+	int* calls = ctx;
+	size_t j;
+
+	++*calls;
+	if (nmatch != 3)
+		return 1;
+
+	preg_bufcat(buf, "[", 1);
+	for (j = 1; j < nmatch; ++j) {
+		if (match[j].rm_so < 0)
+			return 1;
+		preg_bufcat(buf, &subject[match[j].rm_so],
+		            match[j].rm_eo -match[j].rm_so);
+	}
+	preg_bufcat(buf, "]", 1);
+
+	return 0;
+}
+
+int main(void)
+{
+	Preg* rm;
+	int calls = 0;
+
+	rm = preg_init();
+	if (!rm)
+		return EXIT_FAILURE;
+
+	preg_setopt(rm, PREG_SUBMASK, 1 << 2);
+
+	// preg_match() keeps the selected subexpression alone
+	CHECK(!preg_match(rm, "ab cd", "(a|c)(b|d)"));
+	CHECK(preg_so(rm, 0, 1) == -1);
+	CHECK(preg_so(rm, 0, 2) == 1);
+	CHECK(!strcmp(preg_getmatch(rm, 1, 2), "d"));
+
+	// Backreferences to any subexpression
+	CHECK(!preg_replace(rm, "ab cd", "(a|c)(b|d)", "<$1$2>"));
+	CHECK(!strcmp(preg_getrep(rm), "<ab> <cd>"));
+	CHECK(!preg_replace(rm, "ab cd", "(a|c)(b|d)", "<$2>"));
+	CHECK(!strcmp(preg_getrep(rm), "<b> <d>"));
+
+	// No backreferences, right after a masked preg_match()
+	CHECK(!preg_match(rm, "ab cd", "(a|c)(b|d)"));
+	CHECK(!preg_replace(rm, "ab cd", "(a|c)(b|d)", "x"));
+	CHECK(!strcmp(preg_getrep(rm), "x x"));
+
+	// The callback gets every subexpression
+	CHECK(!preg_match(rm, "ab cd", "(a|c)(b|d)"));
+	CHECK(!preg_replace_cb(rm, "ab cd", "(a|c)(b|d)", wrap, &calls));
+	CHECK(calls == 2);
+	CHECK(!strcmp(preg_getrep(rm), "[ab] [cd]"));
+
+	// The option still applies to the next preg_match()
+	CHECK(!preg_match(rm, "ab cd", "(a|c)(b|d)"));
+	CHECK(preg_so(rm, 1, 1) == -1);
+	CHECK(preg_so(rm, 1, 2) == 4);
+
+	preg_free(rm);
+
+	return failures;
+}
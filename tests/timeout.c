@@ -0,0 +1,177 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* PREG_TIMEOUT on a corpus of known pathological patterns. Every pattern
+ * costs regexec() from a tenth of a millisecond to a few milliseconds per
+ * line of the subject, so that each operation would run for seconds, while
+ * the budget is checked between the searches and shall stop it soon after
+ * it runs out */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <regutils.h>
+#include "check.h"
+
+#define LINES   40000           // About 500 KB, enough for PREG_THREADS
+#define BUDGET  20              // Milliseconds
+#define OVERRUN 1.0             // Seconds allowed past the budget
+
+typedef struct {
+	const char* pattern;
+	int bre;
+} Pathological;
+
+static const Pathological corpus[] = {
+	{ "\\(a*\\)*\\(a*\\)*\\2\\1b", 1 },
+	{ "(a*)*(a*)*\\2\\1b", 0 },
+	{ "\\(a*\\)\\(a*\\)*\\1\\2b", 1 },
+	{ "\\(a*\\)*\\1b", 1 },
+	{ "(a*)*\\1b", 0 }
+};
+
+#define CORPUSC (sizeof(corpus) / sizeof(corpus[0]))
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Lines of a run of 8 to 15 'a' followed by a 'b'
+static char* subject_gen(size_t lines)
+{
+	char* s;
+	size_t i, j, k = 0;
+
+	s = malloc(lines * 18 +1);
+	if (!s)
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < lines; ++i) {
+		for (j = 0; j < 8 +i % 8; ++j)
+			s[k++] = 'a';
+		s[k++] = 'b';
+		s[k++] = '\n';
+	}
+	s[k] = '\0';
+
+	return s;
+}
+
+/* Checks that "err" is PREG_TIMEDOUT and that the operation that returned it
+ * at "end" stopped in time */
+static void check_timedout(Preg* rm, int err, double start, double end)
+{
+	CHECK(err == PREG_TIMEDOUT);
+	CHECK(preg_errcode(rm) == PREG_TIMEDOUT);
+	CHECK(end -start < BUDGET / 1000.0 +OVERRUN);
+}
+
+int main(void)
+{
+	const Pathological* p;
+	char* subject;
+	Preg* rm;
+	double start;
+	size_t i;
+	int err;
+
+	subject = subject_gen(LINES);
+
+	// The error is distinct from those of regcomp() and regexec()
+	CHECK(PREG_TIMEDOUT >= PREG_ERRCODE_START && PREG_TIMEDOUT < 0);
+
+	for (i = 0; i < CORPUSC; ++i) {
+		p = &corpus[i];
+
+		rm = preg_init();
+		if (!rm)
+			return EXIT_FAILURE;
+		if (p->bre)
+			preg_delopt(rm, PREG_CFLAGS, REG_EXTENDED);
+
+		// Unbounded, the pattern works on a few lines
+		CHECK(!preg_match(rm, "aaaaaaaab\naaaaaaaaab\n", p->pattern));
+		CHECK(preg_matc(rm) == 2);
+
+		preg_setopt(rm, PREG_TIMEOUT, BUDGET);
+
+		start = now();
+		err = preg_match(rm, subject, p->pattern);
+		check_timedout(rm, err, start, now());
+		CHECK(strstr(preg_errmsg(rm), "Time limit exceeded") != NULL);
+
+		start = now();
+		err = preg_split(rm, subject, p->pattern);
+		check_timedout(rm, err, start, now());
+
+		start = now();
+		err = preg_replace(rm, subject, p->pattern, "<$1>");
+		check_timedout(rm, err, start, now());
+
+		start = now();
+		err = preg_grep(rm, subject, p->pattern);
+		check_timedout(rm, err, start, now());
+
+		CHECK(!preg_addrule(rm, p->pattern, "x"));
+		start = now();
+		err = preg_replace_rules(rm, subject);
+		check_timedout(rm, err, start, now());
+		preg_clearrules(rm);
+
+		// The threads of a parallel replacement keep the budget too
+		preg_setopt(rm, PREG_THREADS, 4);
+		start = now();
+		err = preg_replace(rm, subject, p->pattern, "x");
+		check_timedout(rm, err, start, now());
+		preg_setopt(rm, PREG_THREADS, 1);
+
+		// The budget starts anew with every operation
+		CHECK(!preg_match(rm, "aaaaaaaab\naaaaaaaaab\n", p->pattern));
+		CHECK(preg_matc(rm) == 2);
+
+		preg_free(rm);
+	}
+
+	/* glibc reports subexpression 1 of the second match as (1, 0), which
+	 * reads as not participating */
+	rm = preg_init();
+	if (!rm)
+		return EXIT_FAILURE;
+	preg_delopt(rm, PREG_CFLAGS, REG_EXTENDED);
+	CHECK(!preg_match(rm, "aaaaaaaab\naaaaaaaaab\n", "\\(a*\\)*\\1b"));
+	CHECK(preg_matc(rm) == 2);
+	for (i = 0; i < preg_matc(rm); ++i)
+		CHECK(preg_so(rm, i, 1) <= preg_eo(rm, i, 1));
+	CHECK(!strcmp(preg_getmatch(rm, 1, 1), "") ||
+	      preg_matchlen(rm, 1, 1) == strlen(preg_getmatch(rm, 1, 1)));
+	CHECK(!preg_replace(rm, "aaaaaaaab\naaaaaaaaab\n", "\\(a*\\)*\\1b",
+	                    "<$1>"));
+	preg_free(rm);
+
+	free(subject);
+
+	return failures;
+}
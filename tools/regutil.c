@@ -0,0 +1,504 @@
+/* Copyright 2022 Panayotis Tachtalis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* regutil - grep and sed style command-line tool on top of libregutils
+ *
+ * Usage: regutil [-bFis] [-j threads] [-t ms] command pattern [rep] [file...]
+ *
+ * The input is processed in rounds of whole lines. Every round is cut into
+ * chunks of up to CHUNK_SIZE bytes, one per thread, whose results are written
+ * in order. Regular files are mapped into memory, anything else is read in
+ * blocks, so the tool also works as a filter in pipelines. */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <regutils.h>
+
+#define CHUNK_SIZE  (4 * 1024 * 1024)  // Bytes of input a thread takes at once
+#define MAX_THREADS 64
+
+typedef enum {
+	CMD_MATCH = 0,
+	CMD_COUNT,
+	CMD_REPLACE,
+	CMD_SPLIT
+} Command;
+
+static const char* commands[] = { "match", "count", "replace", "split" };
+
+typedef struct {
+	Command cmd;
+	const char* pattern;
+	const char* rep;
+	int cflags;             // Added to REG_NEWLINE and the default flags
+	int bre;                // Becomes 1 when REG_EXTENDED is cleared
+	int uflags;
+	int timeout;            // PREG_TIMEOUT in milliseconds, or 0
+	int threads;
+	int stats;              // Becomes 1 when the throughput is reported
+} Options;
+
+/* A chunk holds whole lines of the input. Its last newline, or the byte that
+ * follows the input, is overwritten by a null character, so that it can be
+ * given to the library as it is */
+typedef struct {
+	char* s;
+	size_t len;
+	Preg* rm;               // The handle that holds the results
+	int err;
+	int newline;            // Whether the newline that ended it was cut
+} Chunk;
+
+static Options opts;
+static Preg_pool* pool;
+static size_t total_bytes;
+static size_t total_matches;
+
+static void fail(const char* fmt, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "regutil: ");
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+
+	exit(2);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+	    "Usage: regutil [-bFis] [-j threads] [-t ms] command pattern [rep] "
+	    "[file...]\n\n"
+	    "Commands:\n"
+	    "  match    print the lines that match pattern\n"
+	    "  count    print the number of matches of pattern\n"
+	    "  replace  print the input with every match replaced by rep\n"
+	    "  split    print the pieces between the matches, one per line\n\n"
+	    "Options:\n"
+	    "  -b       basic (BRE) instead of extended regular expressions\n"
+	    "  -F       pattern is a literal string\n"
+	    "  -i       ignore case\n"
+	    "  -j n     use up to n threads\n"
+	    "  -s       report the throughput to stderr\n"
+	    "  -t ms    fail if a chunk takes more than ms milliseconds\n");
+
+	exit(2);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Performs the command on a chunk with a handle of the pool
+static void chunk_run(Chunk* c)
+{
+	Preg* rm;
+
+	c->rm = rm = preg_pool_get(pool);
+	if (!rm) {
+		c->err = PREG_MEMFAIL;
+		return;
+	}
+
+	preg_setopt(rm, PREG_CFLAGS, REG_NEWLINE | opts.cflags);
+	if (opts.bre)
+		preg_delopt(rm, PREG_CFLAGS, REG_EXTENDED);
+	if (opts.timeout)
+		preg_setopt(rm, PREG_TIMEOUT, opts.timeout);
+	preg_setopt(rm, PREG_UFLAGS,
+	            opts.uflags | (opts.cmd == CMD_COUNT ? PREG_NOSTRINGS : 0));
+
+	switch (opts.cmd) {
+	case CMD_MATCH:
+		c->err = preg_grep(rm, c->s, opts.pattern);
+		break;
+	case CMD_COUNT:
+		c->err = preg_match(rm, c->s, opts.pattern);
+		break;
+	case CMD_REPLACE:
+		c->err = preg_replace(rm, c->s, opts.pattern, opts.rep);
+		break;
+	case CMD_SPLIT:
+		c->err = preg_split(rm, c->s, opts.pattern);
+		break;
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void* chunk_thread(void* arg)
+{
+	chunk_run(arg);
+
+	return NULL;
+}
+#endif
+
+// Writes the results of a chunk and returns its handle to the pool
+static void chunk_write(Chunk* c)
+{
+	Preg* rm = c->rm;
+	const char* end;
+	size_t start;
+	size_t i;
+
+	if (c->err && c->err != REG_NOMATCH)
+		fail("%s", rm ? preg_errmsg(rm) : "Memory allocation failure");
+
+	switch (opts.cmd) {
+	case CMD_MATCH:
+		if (c->err)
+			break;
+		for (i = 0; i < preg_matc(rm); ++i) {
+			start = preg_linestart(rm, preg_grepline(rm, i));
+			end = memchr(&c->s[start], '\n', c->len -start);
+			fwrite(&c->s[start], 1, (end ? (size_t)(end -c->s) : c->len) -start,
+			       stdout);
+			putchar('\n');
+		}
+		total_matches += preg_matc(rm);
+		break;
+	case CMD_COUNT:
+		if (!c->err)
+			total_matches += preg_matc(rm);
+		break;
+	case CMD_REPLACE:
+		if (c->err)
+			fwrite(c->s, 1, c->len, stdout);
+		else {
+			fwrite(preg_getrep(rm), 1, preg_replen(rm), stdout);
+			total_matches += preg_matc(rm);
+		}
+		if (c->newline)
+			putchar('\n');
+		break;
+	case CMD_SPLIT:
+		if (c->err) {
+			fwrite(c->s, 1, c->len, stdout);
+			if (c->newline)
+				putchar('\n');
+			break;
+		}
+		// The last field ends like the chunk does
+		for (i = 0; i < preg_splitc(rm); ++i) {
+			fwrite(preg_getsplit(rm, i), 1, preg_splitlen(rm, i), stdout);
+			if (i +1 < preg_splitc(rm) || c->newline)
+				putchar('\n');
+		}
+		total_matches += preg_matc(rm);
+		break;
+	}
+
+	preg_pool_put(pool, rm);
+}
+
+/* Processes "len" bytes of whole lines starting at "s". Only the last line of
+ * the input may lack its newline, in which case "s[len]" shall be writable */
+static void round_run(char* s, size_t len)
+{
+	Chunk chunks[MAX_THREADS];
+#ifdef HAVE_PTHREAD
+	pthread_t tids[MAX_THREADS];
+	int started[MAX_THREADS] = { 0 };
+#endif
+	size_t n = (len +CHUNK_SIZE -1) / CHUNK_SIZE;
+	size_t start = 0;
+	size_t end;
+	char* nl;
+	size_t i;
+
+	if (n > (size_t)opts.threads)
+		n = opts.threads;
+
+	// Every chunk ends after the first newline past its share of the round
+	for (i = 0; i < n && start < len; ++i) {
+		end = start +(len -start) / (n -i);
+		if (end < start +1)
+			end = start +1;
+		nl = memchr(&s[end -1], '\n', len -end +1);
+		end = nl ? (size_t)(nl -s) +1 : len;
+
+		chunks[i].s   = &s[start];
+		chunks[i].len = end -start;
+		chunks[i].rm  = NULL;
+		chunks[i].err = 0;
+		chunks[i].newline = nl != NULL;
+		if (nl)
+			chunks[i].len--;
+		chunks[i].s[chunks[i].len] = '\0';
+
+		start = end;
+	}
+	n = i;
+
+#ifdef HAVE_PTHREAD
+	for (i = 1; i < n; ++i)
+		started[i] = !pthread_create(&tids[i], NULL, chunk_thread, &chunks[i]);
+#endif
+	chunk_run(&chunks[0]);
+
+	for (i = 1; i < n; ++i) {
+#ifdef HAVE_PTHREAD
+		if (started[i]) {
+			pthread_join(tids[i], NULL);
+			continue;
+		}
+#endif
+		chunk_run(&chunks[i]);
+	}
+
+	for (i = 0; i < n; ++i)
+		chunk_write(&chunks[i]);
+	fflush(stdout);
+
+	total_bytes += len;
+}
+
+// Returns the end of the last complete line of "s", or NULL
+static char* last_line_end(char* s, size_t len)
+{
+	while (len--)
+		if (s[len] == '\n')
+			return &s[len +1];
+
+	return NULL;
+}
+
+/* Reads "fd" in blocks. A round is processed as soon as no more input is
+ * readily available, or when the buffer is full */
+static void input_stream(int fd, const char* name)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	size_t cap = (size_t)opts.threads * CHUNK_SIZE;
+	size_t fill = 0;
+	ssize_t nread;
+	char* buf;
+	char* end;
+	char* tmp;
+
+	buf = malloc(cap +1);
+	if (!buf)
+		fail("Memory allocation failure");
+
+	for (;;) {
+		nread = read(fd, &buf[fill], cap -fill);
+		if (nread < 0)
+			fail("%s: Read failure", name);
+		if (nread == 0)
+			break;
+		fill += nread;
+
+		if (fill < cap && poll(&pfd, 1, 0) > 0)
+			continue;
+
+		end = last_line_end(buf, fill);
+		if (end) {
+			round_run(buf, end -buf);
+			fill -= end -buf;
+			memmove(buf, end, fill);
+		}
+		else if (fill == cap) {
+			// The line does not fit in the buffer
+			tmp = realloc(buf, 2 * cap +1);
+			if (!tmp)
+				fail("Memory allocation failure");
+			buf = tmp;
+			cap *= 2;
+		}
+	}
+
+	if (fill)
+		round_run(buf, fill);
+
+	free(buf);
+}
+
+#ifdef HAVE_MMAP
+/* Maps "size" bytes of "fd" into memory, followed by an anonymous page that
+ * provides the null character after the last line. The mapping is private,
+ * so the null characters of the chunks never reach the file */
+static void input_map(int fd, const char* name, size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t mapsize = (size +1 +page -1) / page * page;
+	size_t round = (size_t)opts.threads * CHUNK_SIZE;
+	size_t off;
+	size_t end;
+	char* map;
+	char* nl;
+
+	map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+	           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		fail("%s: Memory allocation failure", name);
+	if (mmap(map, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+	         fd, 0) == MAP_FAILED)
+		fail("%s: Cannot map the file", name);
+
+	for (off = 0; off < size; off = end) {
+		end = off +round < size ? off +round : size;
+		if (end < size) {
+			nl = memchr(&map[end -1], '\n', size -end +1);
+			end = nl ? (size_t)(nl -map) +1 : size;
+		}
+		round_run(&map[off], end -off);
+	}
+
+	munmap(map, mapsize);
+}
+#endif
+
+static void input_file(const char* path)
+{
+#ifdef HAVE_MMAP
+	struct stat st;
+#endif
+	int fd;
+
+	if (!strcmp(path, "-")) {
+		input_stream(STDIN_FILENO, "(standard input)");
+		return;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		fail("%s: Cannot open the file", path);
+
+#ifdef HAVE_MMAP
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+		if (st.st_size > 0)
+			input_map(fd, path, st.st_size);
+		close(fd);
+		return;
+	}
+#endif
+	input_stream(fd, path);
+	close(fd);
+}
+
+int main(int argc, char** argv)
+{
+	double start;
+	double elapsed;
+	long ncpu;
+	int opt;
+	size_t i;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	opts.threads = ncpu < 1 ? 1 : ncpu > MAX_THREADS ? MAX_THREADS : ncpu;
+
+	while ((opt = getopt(argc, argv, "bFij:st:")) != -1) {
+		switch (opt) {
+		case 'b':
+			opts.bre = 1;
+			break;
+		case 'F':
+			opts.uflags |= PREG_LITERAL;
+			break;
+		case 'i':
+			opts.cflags |= REG_ICASE;
+			break;
+		case 'j':
+			opts.threads = atoi(optarg);
+			if (opts.threads < 1 || opts.threads > MAX_THREADS)
+				fail("The threads shall be between 1 and %d", MAX_THREADS);
+			break;
+		case 's':
+			opts.stats = 1;
+			break;
+		case 't':
+			opts.timeout = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+#ifndef HAVE_PTHREAD
+	opts.threads = 1;
+#endif
+
+	if (argc -optind < 2)
+		usage();
+
+	for (i = 0; i < sizeof(commands) / sizeof(commands[0]); ++i)
+		if (!strcmp(argv[optind], commands[i]))
+			break;
+	if (i == sizeof(commands) / sizeof(commands[0]))
+		usage();
+	opts.cmd = i;
+	opts.pattern = argv[optind +1];
+	optind += 2;
+
+	if (opts.cmd == CMD_REPLACE) {
+		if (optind == argc)
+			usage();
+		opts.rep = argv[optind++];
+	}
+
+	pool = preg_pool_init(opts.threads, NULL);
+	if (!pool)
+		fail("Memory allocation failure");
+
+	start = now();
+	if (optind == argc)
+		input_stream(STDIN_FILENO, "(standard input)");
+	for (; optind < argc; ++optind)
+		input_file(argv[optind]);
+	elapsed = now() -start;
+
+	if (opts.cmd == CMD_COUNT)
+		printf("%zu\n", total_matches);
+
+	if (opts.stats)
+		fprintf(stderr, "regutil: %zu bytes in %.3f s, %.2f MB/s, "
+		        "%zu matches, %d threads\n", total_bytes, elapsed,
+		        elapsed > 0 ? total_bytes / elapsed / 1e6 : 0.0,
+		        total_matches, opts.threads);
+
+	preg_pool_free(pool);
+
+	if (opts.cmd == CMD_MATCH || opts.cmd == CMD_COUNT)
+		return total_matches ? 0 : 1;
+
+	return 0;
+}